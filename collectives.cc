@@ -0,0 +1,287 @@
+#include "simulator.h"
+#include <algorithm>
+
+using namespace std;
+
+// Collectives.
+//
+// A collective is built as steps of transfers between its ranks. Every rank that receives in a
+// step gets a step task of no cost on its device, which waits for the previous step task of the
+// rank and for the messages of the step, sent by new_comm_task() from the previous step tasks of
+// the senders. The messages are segmented like any other and run on the links of the machine,
+// so the steps of a collective contend with each other and with the rest of the graph.
+//
+// The ranks are placed on a ring or a tree in the order of their memories on the machine, node,
+// socket then device, so that the neighbors are as close as the topology allows:
+// - The ring allreduce sends a chunk of 1/p of the message to the next rank, p - 1 steps to
+//   reduce-scatter and p - 1 steps to all-gather.
+// - The tree allreduce reduces the whole message up a binary tree, a step per level, and
+//   broadcasts it back down.
+// - The recursive halving and doubling allreduce exchanges half of the remaining data with the
+//   rank at distance 1, 2, 4, ..., the nearest first, then all-gathers in the reverse order.
+// - The pairwise all-to-all sends to the rank at distance s at step s, p - 1 steps.
+//
+// estimate_allreduce() estimates an allreduce alone on the machine: a step takes as long as its
+// slowest message, the latency of its path plus the time of its most loaded link to move all the
+// bytes of the step that cross it. The automatic choice is the algorithm with the shortest
+// estimate, so it follows the bandwidths and the sharing of the links of the machine.
+
+namespace
+{
+
+typedef vector<vector<CollectiveTransfer> > Steps;
+
+MemDevice *mem_of(Task const *task)
+{
+    return ((CompTask const *)task)->mem;
+}
+
+// the ranks in the order of their memories on the machine
+vector<int> topological_order(vector<Task *> const &src_tasks)
+{
+    vector<int> order(src_tasks.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&](int lhs, int rhs) {
+        MemDevice const *l = mem_of(src_tasks[lhs]);
+        MemDevice const *r = mem_of(src_tasks[rhs]);
+        return make_tuple(l->node_id, l->socket_id, l->device_id) < make_tuple(r->node_id, r->socket_id, r->device_id);
+    });
+    return order;
+}
+
+void ring_allreduce(vector<int> const &order, size_t message_size, Steps &steps)
+{
+    size_t p = order.size();
+    size_t chunk = (message_size + p - 1) / p;
+    for (size_t s = 0; s < 2 * (p - 1); s++)
+    {
+        steps.emplace_back();
+        for (size_t i = 0; i < p; i++)
+        {
+            steps.back().push_back({order[i], order[(i + 1) % p], chunk});
+        }
+    }
+}
+
+void tree_allreduce(vector<int> const &order, size_t message_size, Steps &steps)
+{
+    // a binary heap over the order, the children of i are 2i + 1 and 2i + 2
+    size_t p = order.size();
+    int depth = 0;
+    while (((size_t)2 << depth) - 1 < p)
+    {
+        depth++;
+    }
+    for (int level = depth; level > 0; level--)
+    {
+        steps.emplace_back();
+        for (size_t i = ((size_t)1 << level) - 1; i < min(p, ((size_t)2 << level) - 1); i++)
+        {
+            steps.back().push_back({order[i], order[(i - 1) / 2], message_size});
+        }
+    }
+    for (int level = 1; level <= depth; level++)
+    {
+        steps.emplace_back();
+        for (size_t i = ((size_t)1 << level) - 1; i < min(p, ((size_t)2 << level) - 1); i++)
+        {
+            steps.back().push_back({order[(i - 1) / 2], order[i], message_size});
+        }
+    }
+}
+
+bool halving_doubling_allreduce(vector<int> const &order, size_t message_size, Steps &steps)
+{
+    size_t p = order.size();
+    if ((p & (p - 1)) != 0)
+    {
+        return false;
+    }
+    vector<size_t> sizes;
+    size_t size = message_size;
+    for (size_t distance = 1; distance < p; distance *= 2)
+    {
+        size = (size + 1) / 2;
+        sizes.push_back(size);
+        steps.emplace_back();
+        for (size_t i = 0; i < p; i++)
+        {
+            steps.back().push_back({order[i], order[i ^ distance], size});
+        }
+    }
+    for (size_t distance = p / 2; distance >= 1; distance /= 2)
+    {
+        size = sizes.back();
+        sizes.pop_back();
+        steps.emplace_back();
+        for (size_t i = 0; i < p; i++)
+        {
+            steps.back().push_back({order[i], order[i ^ distance], size});
+        }
+    }
+    return true;
+}
+
+bool allreduce_steps(vector<Task *> const &src_tasks, size_t message_size, Simulator::CollectiveAlgorithm algorithm,
+                     Steps &steps)
+{
+    vector<int> order = topological_order(src_tasks);
+    switch (algorithm)
+    {
+    case Simulator::RING_ALLREDUCE:
+        ring_allreduce(order, message_size, steps);
+        return true;
+    case Simulator::TREE_ALLREDUCE:
+        tree_allreduce(order, message_size, steps);
+        return true;
+    case Simulator::HALVING_DOUBLING_ALLREDUCE:
+        return halving_doubling_allreduce(order, message_size, steps);
+    default:
+        return false;
+    }
+}
+
+char const *algorithm_name(Simulator::CollectiveAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case Simulator::RING_ALLREDUCE:
+        return "ring allreduce";
+    case Simulator::TREE_ALLREDUCE:
+        return "tree allreduce";
+    case Simulator::HALVING_DOUBLING_ALLREDUCE:
+        return "halving doubling allreduce";
+    default:
+        return "allreduce";
+    }
+}
+
+} // namespace
+
+void Simulator::new_collective(string const &name, vector<Task *> const &src_tasks, vector<Task *> const &tar_tasks,
+                               Steps const &steps)
+{
+    assert(src_tasks.size() == tar_tasks.size());
+    string const *text = intern(name);
+    vector<Task *> cur_tasks = src_tasks;
+    vector<Task *> step_tasks(src_tasks.size(), nullptr);
+    for (size_t s = 0; s < steps.size(); s++)
+    {
+        for (size_t i = 0; i < steps[s].size(); i++)
+        {
+            CollectiveTransfer const &transfer = steps[s][i];
+            Task *&step_task = step_tasks[transfer.to];
+            if (step_task == nullptr)
+            {
+                CompTask const *rank = (CompTask const *)src_tasks[transfer.to];
+                step_task = new_comp_task(TaskName(TaskName::STEP, text, s), (CompDevice *)rank->device, 0, rank->mem);
+                step_task->kind = text;
+                add_dependency(cur_tasks[transfer.to], step_task);
+            }
+            new_comm_task(cur_tasks[transfer.from], step_task, transfer.size);
+        }
+        for (size_t i = 0; i < steps[s].size(); i++)
+        {
+            int rank = steps[s][i].to;
+            if (step_tasks[rank] != nullptr)
+            {
+                cur_tasks[rank] = step_tasks[rank];
+                step_tasks[rank] = nullptr;
+            }
+        }
+    }
+    for (size_t i = 0; i < tar_tasks.size(); i++)
+    {
+        add_dependency(cur_tasks[i], tar_tasks[i]);
+    }
+}
+
+Simulator::CollectiveAlgorithm Simulator::new_allreduce(vector<Task *> const &src_tasks, vector<Task *> const &tar_tasks,
+                                                        size_t message_size, CollectiveAlgorithm algorithm)
+{
+    if (algorithm == AUTO_ALGORITHM)
+    {
+        float best_time = numeric_limits<float>::infinity();
+        for (int i = RING_ALLREDUCE; i <= HALVING_DOUBLING_ALLREDUCE; i++)
+        {
+            float time = estimate_allreduce(src_tasks, message_size, (CollectiveAlgorithm)i);
+            if (time < best_time)
+            {
+                best_time = time;
+                algorithm = (CollectiveAlgorithm)i;
+            }
+        }
+    }
+    Steps steps;
+    if (src_tasks.size() > 1 and !allreduce_steps(src_tasks, message_size, algorithm, steps))
+    {
+        printf("Simulator: new_allreduce - %s does not apply to %zu ranks\n", algorithm_name(algorithm), src_tasks.size());
+        assert(false);
+    }
+    new_collective(algorithm_name(algorithm), src_tasks, tar_tasks, steps);
+    return algorithm;
+}
+
+void Simulator::new_all_to_all(vector<Task *> const &src_tasks, vector<Task *> const &tar_tasks, size_t message_size)
+{
+    vector<int> order = topological_order(src_tasks);
+    size_t p = order.size();
+    Steps steps;
+    for (size_t s = 1; s < p; s++)
+    {
+        steps.emplace_back();
+        for (size_t i = 0; i < p; i++)
+        {
+            steps.back().push_back({order[i], order[(i + s) % p], message_size});
+        }
+    }
+    new_collective("all-to-all", src_tasks, tar_tasks, steps);
+}
+
+float Simulator::estimate_allreduce(vector<Task *> const &src_tasks, size_t message_size, CollectiveAlgorithm algorithm)
+{
+    Steps steps;
+    if (src_tasks.size() > 1 and !allreduce_steps(src_tasks, message_size, algorithm, steps))
+    {
+        return numeric_limits<float>::infinity();
+    }
+    vector<double> loads(machine->get_num_devices(), 0);
+    double time = 0;
+    for (size_t s = 0; s < steps.size(); s++)
+    {
+        vector<CommPath> paths(steps[s].size());
+        for (size_t i = 0; i < steps[s].size(); i++)
+        {
+            CollectiveTransfer const &transfer = steps[s][i];
+            paths[i] = machine->peek_comm_path(mem_of(src_tasks[transfer.from]), mem_of(src_tasks[transfer.to]));
+            for (size_t j = 0; j < paths[i].size(); j++)
+            {
+                loads[paths[i][j]->index] += transfer.size;
+            }
+        }
+        double step_time = 0;
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            double latency = 0;
+            double transfer_time = 0;
+            for (size_t j = 0; j < paths[i].size(); j++)
+            {
+                latency += paths[i][j]->latency;
+                transfer_time = max(transfer_time, loads[paths[i][j]->index] / paths[i][j]->bandwidth);
+            }
+            step_time = max(step_time, latency + transfer_time);
+        }
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            for (size_t j = 0; j < paths[i].size(); j++)
+            {
+                loads[paths[i][j]->index] = 0;
+            }
+        }
+        time += step_time;
+    }
+    return time;
+}
@@ -0,0 +1,252 @@
+#include "simulator.h"
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+
+// Fluid model of the communication.
+//
+// The segmented model runs every segment of a message on every link of its path in turn, and a
+// link runs one segment at a time. In the flow model a message is one flow over its whole path,
+// and all the flows on a link transfer at the same time. The rates are max-min fair: progressive
+// filling raises the rates of all the flows together, and each time a link is saturated, the
+// flows through it are frozen at its fair share, the remaining bandwidth of the link divided by
+// its unfrozen flows. The links are taken in the order of their fair share from a heap, whose
+// entries are invalidated by a version when a link loses bandwidth to a flow frozen elsewhere.
+//
+// A flow that starts or finishes only changes the rates of the flows connected to it by shared
+// links, so only that component is refilled. The flows that start or finish at the same time,
+// a collective or the symmetric flows of an all-to-all, are refilled together when the next
+// finish time is needed. A flow keeps its finish event while its rate does not change; the events
+// of the older rates are dropped lazily when they reach the top of the heap. The latency of the
+// links is added when the last byte arrives.
+
+namespace
+{
+
+// compact the finish events when more than this many of them per active flow are stale
+const size_t MAX_EVENTS_PER_FLOW = 4;
+
+} // namespace
+
+void FlowModel::init(MachineModel *machine)
+{
+    flows.clear();
+    free_flows.clear();
+    num_flows = 0;
+    peak_flows = 0;
+    finish_events.clear();
+    epoch = 0;
+    pending_links.clear();
+    links.assign(machine->get_num_devices(), Link());
+    for (int i = 0; i < machine->get_num_devices(); i++)
+    {
+        Device *device = machine->get_device(i);
+        links[i].bandwidth = device->type == Device::DEVICE_COMM ? ((CommDevice *)device)->bandwidth : 0;
+        links[i].epoch = 0;
+        links[i].version = 0;
+    }
+}
+
+void FlowModel::start(task_id_t task, vector<CommDevice *> const &path, double bytes, simtime_t now)
+{
+    if (!pending_links.empty() and pending_time != now)
+    {
+        reallocate();
+    }
+    uint32_t slot;
+    if (free_flows.empty())
+    {
+        slot = flows.size();
+        flows.emplace_back();
+        flows[slot].version = 0;
+        flows[slot].epoch = 0;
+    }
+    else
+    {
+        slot = free_flows.back();
+        free_flows.pop_back();
+    }
+    Flow &flow = flows[slot];
+    flow.task = task;
+    flow.remaining = bytes;
+    flow.rate = 0;
+    flow.last_update = now;
+    flow.links.clear();
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        Link &link = links[path[i]->index];
+        flow.links.emplace_back(path[i]->index, link.flows.size());
+        link.flows.push_back(slot);
+    }
+    num_flows++;
+    peak_flows = max(peak_flows, num_flows);
+    pending_links.insert(pending_links.end(), flow.links.begin(), flow.links.end());
+    pending_time = now;
+}
+
+simtime_t FlowModel::next_finish_time()
+{
+    for (bool reallocated = false;; reallocated = true)
+    {
+        while (!finish_events.empty() and finish_events.front().version != flows[finish_events.front().flow].version)
+        {
+            pop_heap(finish_events.begin(), finish_events.end(), greater<FinishEvent>());
+            finish_events.pop_back();
+        }
+        // a flow that finishes when the pending flows start or finish finishes whatever their
+        // rates, any other flow may finish earlier with them
+        if (reallocated or pending_links.empty() or
+            (!finish_events.empty() and finish_events.front().time == pending_time))
+        {
+            return finish_events.empty() ? SIMTIME_MAX : finish_events.front().time;
+        }
+        reallocate();
+    }
+}
+
+bool FlowModel::finishes_before(simtime_t time)
+{
+    if (!pending_links.empty() and time <= pending_time)
+    {
+        return false;
+    }
+    return next_finish_time() < time;
+}
+
+task_id_t FlowModel::finish()
+{
+    simtime_t now = next_finish_time();
+    assert(now != SIMTIME_MAX);
+    FinishEvent event = finish_events.front();
+    pop_heap(finish_events.begin(), finish_events.end(), greater<FinishEvent>());
+    finish_events.pop_back();
+    Flow &flow = flows[event.flow];
+    for (size_t i = 0; i < flow.links.size(); i++)
+    {
+        // swap the last flow of the link into the position of this one
+        Link &link = links[flow.links[i].first];
+        uint32_t position = flow.links[i].second;
+        uint32_t moved = link.flows.back();
+        link.flows[position] = moved;
+        link.flows.pop_back();
+        for (size_t j = 0; moved != event.flow and j < flows[moved].links.size(); j++)
+        {
+            if (flows[moved].links[j].first == flow.links[i].first)
+            {
+                flows[moved].links[j].second = position;
+            }
+        }
+    }
+    pending_links.insert(pending_links.end(), flow.links.begin(), flow.links.end());
+    pending_time = now;
+    flow.version++;
+    free_flows.push_back(event.flow);
+    num_flows--;
+    return event.task;
+}
+
+void FlowModel::reallocate()
+{
+    simtime_t now = pending_time;
+    epoch++;
+    component_links.clear();
+    component_flows.clear();
+    for (size_t i = 0; i < pending_links.size(); i++)
+    {
+        if (links[pending_links[i].first].epoch != epoch)
+        {
+            links[pending_links[i].first].epoch = epoch;
+            component_links.push_back(pending_links[i].first);
+        }
+    }
+    pending_links.clear();
+    // the component of the seed links: the flows on its links and the links of its flows
+    for (size_t i = 0; i < component_links.size(); i++)
+    {
+        Link const &link = links[component_links[i]];
+        for (size_t j = 0; j < link.flows.size(); j++)
+        {
+            Flow &flow = flows[link.flows[j]];
+            if (flow.epoch == epoch)
+            {
+                continue;
+            }
+            flow.epoch = epoch;
+            component_flows.push_back(link.flows[j]);
+            for (size_t k = 0; k < flow.links.size(); k++)
+            {
+                if (links[flow.links[k].first].epoch != epoch)
+                {
+                    links[flow.links[k].first].epoch = epoch;
+                    component_links.push_back(flow.links[k].first);
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < component_flows.size(); i++)
+    {
+        Flow &flow = flows[component_flows[i]];
+        flow.remaining = max(0.0, flow.remaining - flow.rate * to_ms(now - flow.last_update));
+        flow.last_update = now;
+        flow.frozen = false;
+    }
+    for (size_t i = 0; i < component_links.size(); i++)
+    {
+        Link &link = links[component_links[i]];
+        link.remaining = link.bandwidth;
+        link.num_unfrozen = link.flows.size();
+        link.version++;
+        if (link.num_unfrozen > 0)
+        {
+            shares.emplace(link.remaining / link.num_unfrozen, component_links[i], link.version);
+        }
+    }
+    // progressive filling
+    while (!shares.empty())
+    {
+        double share = get<0>(shares.top());
+        Link &link = links[get<1>(shares.top())];
+        uint32_t version = get<2>(shares.top());
+        shares.pop();
+        if (version != link.version)
+        {
+            continue;
+        }
+        for (size_t i = 0; i < link.flows.size(); i++)
+        {
+            uint32_t slot = link.flows[i];
+            Flow &flow = flows[slot];
+            if (flow.frozen)
+            {
+                continue;
+            }
+            flow.frozen = true;
+            for (size_t j = 0; j < flow.links.size(); j++)
+            {
+                Link &other = links[flow.links[j].first];
+                other.remaining = max(0.0, other.remaining - share);
+                other.num_unfrozen--;
+                other.version++;
+                if (other.num_unfrozen > 0 and &other != &link)
+                {
+                    shares.emplace(other.remaining / other.num_unfrozen, flow.links[j].first, other.version);
+                }
+            }
+            if (share != flow.rate)
+            {
+                flow.rate = share;
+                flow.version++;
+                finish_events.push_back({now + to_simtime(flow.remaining / share), flow.task, slot, flow.version});
+                push_heap(finish_events.begin(), finish_events.end(), greater<FinishEvent>());
+            }
+        }
+    }
+    if (finish_events.size() > MAX_EVENTS_PER_FLOW * num_flows + 64)
+    {
+        finish_events.erase(remove_if(finish_events.begin(), finish_events.end(),
+                                      [&](FinishEvent const &event) { return event.version != flows[event.flow].version; }),
+                            finish_events.end());
+        make_heap(finish_events.begin(), finish_events.end(), greater<FinishEvent>());
+    }
+}
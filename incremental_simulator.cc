@@ -0,0 +1,530 @@
+#include "simulator.h"
+#include <algorithm>
+
+using namespace std;
+
+// Incremental re-simulation.
+//
+// The sequential engine runs the tasks in the order it pops them from the ready queue, and the
+// i-th task of a device runs on sub-device i mod max_sub_device. An edit of the cost or the device
+// of a task cannot change anything before the task in the recorded order, so resimulate() replays
+// the ready queue from the position of the earliest edited task on. The queue of that moment is
+// never rebuilt: a task whose predecessors all ran when and in the order they were recorded is
+// "clean", it becomes ready at the recorded moment with its recorded ready time, and the clean
+// tasks leave the queue in their recorded order. Only the other, "dirty", tasks go through the
+// ready queue, and the next task to run is the earlier of the next clean task of the recorded order
+// and the top of the queue.
+//
+// The replay stops as soon as the rest of the recorded schedule holds again: no dirty task is left,
+// the replayed tasks are exactly the recorded ones up to the cursor, and no device is in a state
+// that changes one of its recorded tasks after the cursor, see Schedule::check_device(). An edit
+// of a task with slack therefore replays a few tasks, while an edit on the critical path still
+// replays everything after it.
+
+namespace
+{
+
+// end time of the last recorded task on sub-device j of a device after its first count tasks
+inline simtime_t recorded_sub_device_time(Schedule const &schedule, Device const *device, uint32_t count, int j)
+{
+    if ((uint32_t)j >= count)
+    {
+        return 0;
+    }
+    uint32_t m = device->max_sub_device;
+    uint32_t i = j + (count - 1 - j) / m * m;
+    return schedule.end_times[schedule.device_tasks[device->index][i]];
+}
+
+} // namespace
+
+// class Schedule
+const uint32_t Schedule::NOT_RUN;
+
+void Schedule::init(TaskGraph const &graph)
+{
+    this->graph = &graph;
+    size_t num_tasks = graph.num_tasks();
+    order.clear();
+    positions.assign(num_tasks, NOT_RUN);
+    ready_times.assign(num_tasks, 0);
+    start_times.assign(num_tasks, 0);
+    run_times.assign(num_tasks, 0);
+    end_times.assign(num_tasks, 0);
+    sub_devices.assign(num_tasks, nullptr);
+    edited_tasks.clear();
+    prev_offsets.assign(num_tasks + 1, 0);
+    for (size_t i = 0; i < graph.next_tasks.size(); i++)
+    {
+        prev_offsets[graph.next_tasks[i] + 1]++;
+    }
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        prev_offsets[i + 1] += prev_offsets[i];
+    }
+    prev_tasks.resize(graph.next_tasks.size());
+    vector<uint32_t> next_prev(prev_offsets.begin(), prev_offsets.end() - 1);
+    for (size_t task = 0; task < num_tasks; task++)
+    {
+        for (uint32_t i = graph.next_offsets[task]; i < graph.next_offsets[task + 1]; i++)
+        {
+            prev_tasks[next_prev[graph.next_tasks[i]]++] = task;
+        }
+    }
+}
+
+void Schedule::record(task_id_t task, SubDevice *sub_device, simtime_t ready_time, simtime_t start_time,
+                      simtime_t run_time, simtime_t end_time)
+{
+    positions[task] = order.size();
+    order.push_back(task);
+    ready_times[task] = ready_time;
+    start_times[task] = start_time;
+    run_times[task] = run_time;
+    end_times[task] = end_time;
+    sub_devices[task] = sub_device;
+}
+
+void Schedule::finish(MachineModel *machine)
+{
+    size_t num_tasks = positions.size();
+    device_tasks.resize(machine->get_num_devices());
+    for (size_t i = 0; i < device_tasks.size(); i++)
+    {
+        device_tasks[i].clear();
+    }
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        device_tasks[sub_devices[order[i]]->main_device->index].push_back(order[i]);
+    }
+    end_time_tree.assign(2 * num_tasks, 0);
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        end_time_tree[num_tasks + i] = end_times[i];
+    }
+    for (size_t i = num_tasks; i-- > 1;)
+    {
+        end_time_tree[i] = max(end_time_tree[2 * i], end_time_tree[2 * i + 1]);
+    }
+    epoch = 0;
+    popped_epochs.assign(num_tasks, 0);
+    dirty_epochs.assign(num_tasks, 0);
+    counters.resize(num_tasks);
+    replay_ready_times.resize(num_tasks);
+    replay_start_times.resize(num_tasks);
+    replay_end_times.resize(num_tasks);
+    replay_sub_devices.resize(num_tasks);
+    device_epochs.assign(machine->get_num_devices(), 0);
+    device_starts.resize(machine->get_num_devices());
+    device_counts.resize(machine->get_num_devices());
+    device_recorded_counts.resize(machine->get_num_devices());
+    device_synced.resize(machine->get_num_devices());
+    sub_device_times.resize(machine->get_num_sub_devices());
+    round_robin = true;
+    for (int i = 0; i < machine->get_num_devices(); i++)
+    {
+        Device const *device = machine->get_device(i);
+        round_robin &= device->max_sub_device == 1 or device->sub_device_policy == Device::ROUND_ROBIN;
+    }
+}
+
+simtime_t Schedule::get_sim_time() const
+{
+    return end_time_tree.size() > 1 ? end_time_tree[1] : 0;
+}
+
+void Schedule::set_end_time(task_id_t task, simtime_t end_time)
+{
+    size_t i = positions.size() + task;
+    end_time_tree[i] = end_time;
+    for (i >>= 1; i >= 1; i >>= 1)
+    {
+        end_time_tree[i] = max(end_time_tree[2 * i], end_time_tree[2 * i + 1]);
+    }
+}
+
+uint32_t Schedule::recorded_count(Device const *device, uint32_t position) const
+{
+    vector<task_id_t> const &tasks = device_tasks[device->index];
+    return lower_bound(tasks.begin(), tasks.end(), position,
+                       [&](task_id_t task, uint32_t position) { return positions[task] < position; }) -
+           tasks.begin();
+}
+
+void Schedule::touch_device(Device const *device, uint32_t start)
+{
+    if (device_epochs[device->index] == epoch)
+    {
+        return;
+    }
+    device_epochs[device->index] = epoch;
+    uint32_t count = recorded_count(device, start);
+    device_starts[device->index] = count;
+    device_counts[device->index] = count;
+    device_recorded_counts[device->index] = count;
+    for (int j = 0; j < device->max_sub_device; j++)
+    {
+        sub_device_times[device->sub_devices[j]->index] = recorded_sub_device_time(*this, device, count, j);
+    }
+    device_synced[device->index] = 1;
+    touched_devices.push_back(device);
+}
+
+void Schedule::check_device(Device const *device)
+{
+    // The state of a sub-device only matters to the next recorded task on it, and not even to
+    // that one if the task still starts at its recorded start time.
+    vector<task_id_t> const &tasks = device_tasks[device->index];
+    uint32_t count = device_recorded_counts[device->index];
+    uint32_t m = device->max_sub_device;
+    bool synced = count == tasks.size() or device_counts[device->index] % m == count % m;
+    for (uint32_t j = 0; synced and j < m and count < tasks.size(); j++)
+    {
+        simtime_t time = sub_device_times[device->sub_devices[j]->index];
+        if (time != recorded_sub_device_time(*this, device, count, j))
+        {
+            uint32_t next = count + (j + m - count % m) % m;
+            synced = next >= tasks.size() or max(time, ready_times[tasks[next]]) == start_times[tasks[next]];
+        }
+    }
+    if (synced != (bool)device_synced[device->index])
+    {
+        device_synced[device->index] = synced;
+        if (synced)
+        {
+            num_unsynced_devices--;
+        }
+        else
+        {
+            num_unsynced_devices++;
+        }
+    }
+}
+
+// class Simulator
+void Simulator::set_incremental(bool incremental)
+{
+    this->incremental = incremental;
+}
+
+void Simulator::set_run_time(Task *task, float run_time)
+{
+    assert(incremental and schedule.graph != nullptr);
+    run.costs[task->id] = to_simtime(run_time);
+    schedule.edited_tasks.push_back(task->id);
+}
+
+void Simulator::set_device(Task *task, CompDevice *device)
+{
+    assert(incremental and schedule.graph != nullptr);
+    assert(run.devices[task->id]->type == Device::DEVICE_COMP);
+    run.devices[task->id] = device;
+    schedule.edited_tasks.push_back(task->id);
+}
+
+simtime_t Simulator::resimulate()
+{
+    Schedule &s = schedule;
+    assert(incremental and s.graph != nullptr);
+    TaskGraph const &graph = *s.graph;
+    ProfilePhase phase(profile, "resimulate");
+    uint32_t start = Schedule::NOT_RUN;
+    uint32_t last_edit = 0;
+    for (size_t i = 0; i < s.edited_tasks.size(); i++)
+    {
+        uint32_t position = s.positions[s.edited_tasks[i]];
+        if (position != Schedule::NOT_RUN)
+        {
+            start = min(start, position);
+            last_edit = max(last_edit, position);
+        }
+    }
+    s.edited_tasks.clear();
+    if (start == Schedule::NOT_RUN)
+    {
+        return sim_time;
+    }
+    if (!s.round_robin)
+    {
+        // The other policies pick a sub-device by the state of all of them, which the replay does
+        // not follow, so simulate the whole graph again with the edits.
+        vector<simtime_t> costs;
+        vector<Device *> devices;
+        costs.swap(run.costs);
+        devices.swap(run.devices);
+        run.init(graph, machine);
+        costs.swap(run.costs);
+        devices.swap(run.devices);
+        TraceSink *saved_trace_sink = trace_sink;
+        trace_sink = &null_trace_sink;
+        sim_time = 0;
+        total_comp_time = 0;
+        total_simulated_comp_tasks = 0;
+        total_comm_time = 0;
+        s.init(graph);
+        simulate_sequential(graph);
+        s.finish(machine);
+        trace_sink = saved_trace_sink;
+        phase.stop();
+        if (profile != nullptr)
+        {
+            profile->add_count("resimulations", 1);
+            profile->add_count("replayed_events", s.order.size());
+            profile->add_queue_stats(ready_queue->stats);
+            ready_queue->stats = ReadyQueue::Stats();
+        }
+        return sim_time;
+    }
+    s.epoch++;
+    s.num_unsynced_devices = 0;
+    s.replay_order.clear();
+    s.touched_devices.clear();
+    uint32_t num_recorded = s.order.size();
+    uint32_t cursor = start;    // next task of the recorded order
+    uint32_t clean_end = start; // position after the last clean task taken from the recorded order
+    size_t num_pending = 0;     // dirty tasks waiting for their predecessors
+    size_t num_ahead = 0;       // replayed tasks the cursor has not passed yet
+    // A dirty task waits for the edges of its predecessors that did not run yet, where the edges of
+    // the running task count as not run since they are passed right after.
+    auto mark_dirty = [&](task_id_t task, task_id_t running_task) {
+        s.dirty_epochs[task] = s.epoch;
+        int counter = 0;
+        simtime_t ready_time = 0;
+        for (uint32_t j = s.prev_offsets[task]; j < s.prev_offsets[task + 1]; j++)
+        {
+            task_id_t prev = s.prev_tasks[j];
+            if (prev == running_task)
+            {
+                counter++;
+            }
+            else if (s.popped_epochs[prev] == s.epoch)
+            {
+                ready_time = max(ready_time, s.replay_end_times[prev]);
+            }
+            else if (s.positions[prev] < start)
+            {
+                ready_time = max(ready_time, s.end_times[prev]);
+            }
+            else
+            {
+                counter++;
+            }
+        }
+        s.counters[task] = counter;
+        s.replay_ready_times[task] = ready_time;
+        num_pending++;
+    };
+    // A clean task only runs when its predecessors ran, some of them may be dirty and late.
+    auto waits = [&](task_id_t task) {
+        for (uint32_t j = s.prev_offsets[task]; j < s.prev_offsets[task + 1]; j++)
+        {
+            task_id_t prev = s.prev_tasks[j];
+            if (s.popped_epochs[prev] != s.epoch and s.positions[prev] >= start)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    while (true)
+    {
+        // pass the recorded tasks that were replayed already or that are dirty
+        while (cursor < num_recorded)
+        {
+            task_id_t task = s.order[cursor];
+            if (s.popped_epochs[task] == s.epoch)
+            {
+                num_ahead--;
+            }
+            else if (s.dirty_epochs[task] != s.epoch)
+            {
+                if ((num_pending == 0 and ready_queue->empty()) or !waits(task))
+                {
+                    break;
+                }
+                mark_dirty(task, task);
+            }
+            cursor++;
+            Device const *device = s.sub_devices[task]->main_device;
+            s.touch_device(device, start);
+            s.device_recorded_counts[device->index]++;
+            s.check_device(device);
+        }
+        if (cursor > last_edit and ready_queue->empty() and num_pending == 0 and num_ahead == 0 and
+            s.num_unsynced_devices == 0)
+        {
+            break;
+        }
+        bool from_queue;
+        if (cursor == num_recorded)
+        {
+            if (ready_queue->empty())
+            {
+                break;
+            }
+            from_queue = true;
+        }
+        else
+        {
+            task_id_t task = s.order[cursor];
+            from_queue = !ready_queue->empty() and TaskCompare()({s.ready_times[task], task}, ready_queue->top());
+        }
+
+        task_id_t cur_task;
+        simtime_t ready_time;
+        bool on_schedule;
+        if (from_queue)
+        {
+            ReadyTask ready_task = ready_queue->pop();
+            cur_task = ready_task.id;
+            ready_time = ready_task.ready_time;
+            // a dirty task that runs between the same clean tasks as recorded enables its
+            // successors at the recorded moment
+            uint32_t position = s.positions[cur_task];
+            on_schedule = position >= clean_end and position < cursor;
+            if (position >= cursor)
+            {
+                num_ahead++;
+            }
+        }
+        else
+        {
+            cur_task = s.order[cursor++];
+            ready_time = s.ready_times[cur_task];
+            clean_end = cursor;
+            on_schedule = true;
+        }
+        s.popped_epochs[cur_task] = s.epoch;
+        Device *device = run.devices[cur_task];
+        s.touch_device(device, start);
+        uint32_t &count = s.device_counts[device->index];
+        SubDevice *cur_sub_device = device->sub_devices[count % device->max_sub_device];
+        count++;
+        simtime_t &device_time = s.sub_device_times[cur_sub_device->index];
+        simtime_t start_time = max(device_time, ready_time);
+        simtime_t end_time = start_time + run.costs[cur_task];
+        device_time = end_time;
+        s.replay_ready_times[cur_task] = ready_time;
+        s.replay_start_times[cur_task] = start_time;
+        s.replay_end_times[cur_task] = end_time;
+        s.replay_sub_devices[cur_task] = cur_sub_device;
+        s.replay_order.push_back(cur_task);
+        if (!from_queue)
+        {
+            Device const *recorded_device = s.sub_devices[cur_task]->main_device;
+            s.touch_device(recorded_device, start);
+            s.device_recorded_counts[recorded_device->index]++;
+            if (recorded_device != device)
+            {
+                s.check_device(recorded_device);
+            }
+        }
+        s.check_device(device);
+
+        bool changed = !on_schedule or end_time != s.end_times[cur_task];
+        for (uint32_t i = graph.next_offsets[cur_task]; i < graph.next_offsets[cur_task + 1]; i++)
+        {
+            task_id_t next = graph.next_tasks[i];
+            if (s.dirty_epochs[next] != s.epoch)
+            {
+                if (!changed)
+                {
+                    continue;
+                }
+                mark_dirty(next, cur_task);
+            }
+            s.replay_ready_times[next] = max(s.replay_ready_times[next], end_time);
+            if (--s.counters[next] == 0)
+            {
+                ready_queue->push({s.replay_ready_times[next], next});
+                num_pending--;
+            }
+        }
+    }
+
+    // The replayed tasks are the recorded tasks from start to the cursor in a new order: move them
+    // into the schedule, first in the task lists of their devices, which are sorted by the old
+    // positions, and then in the order.
+    uint32_t end = cursor;
+    assert(s.replay_order.size() == end - start);
+    for (size_t i = 0; i < s.touched_devices.size(); i++)
+    {
+        Device const *device = s.touched_devices[i];
+        if (end == num_recorded)
+        {
+            // the replay ran to the end, so the state of the device is its final one
+            run.cur_sub_devices[device->index] = s.device_counts[device->index] % device->max_sub_device;
+            for (int j = 0; j < device->max_sub_device; j++)
+            {
+                int index = device->sub_devices[j]->index;
+                run.sub_device_times[index] = s.sub_device_times[index];
+            }
+        }
+        vector<task_id_t> &tasks = s.device_tasks[device->index];
+        uint32_t lo = s.device_starts[device->index];
+        uint32_t hi = s.recorded_count(device, end);
+        uint32_t num_replayed = s.device_counts[device->index] - lo;
+        if (num_replayed > hi - lo)
+        {
+            tasks.insert(tasks.begin() + hi, num_replayed - (hi - lo), 0);
+        }
+        else if (num_replayed < hi - lo)
+        {
+            tasks.erase(tasks.begin() + lo + num_replayed, tasks.begin() + hi);
+        }
+        s.device_counts[device->index] = lo;
+    }
+    for (uint32_t i = 0; i < s.replay_order.size(); i++)
+    {
+        task_id_t task = s.replay_order[i];
+        Device const *device = s.replay_sub_devices[task]->main_device;
+        s.device_tasks[device->index][s.device_counts[device->index]++] = task;
+    }
+    // The totals are updated by the differences, so in float time they may differ from a full
+    // simulation in the rounding of the last bits; sim_time is exact.
+    for (uint32_t i = 0; i < s.replay_order.size(); i++)
+    {
+        task_id_t task = s.replay_order[i];
+        SubDevice *sub_device = s.replay_sub_devices[task];
+        simtime_t run_time = run.costs[task];
+        if (sub_device != s.sub_devices[task] or run_time != s.run_times[task])
+        {
+            run.sub_device_busy_times[s.sub_devices[task]->index] -= s.run_times[task];
+            run.sub_device_num_tasks[s.sub_devices[task]->index]--;
+            run.sub_device_busy_times[sub_device->index] += run_time;
+            run.sub_device_num_tasks[sub_device->index]++;
+        }
+        if (run_time != s.run_times[task])
+        {
+            if (run.devices[task]->type == Device::DEVICE_COMP)
+            {
+                total_comp_time += run_time - s.run_times[task];
+            }
+            else
+            {
+                total_comm_time += run_time - s.run_times[task];
+            }
+        }
+        s.order[start + i] = task;
+        s.positions[task] = start + i;
+        s.ready_times[task] = s.replay_ready_times[task];
+        s.start_times[task] = s.replay_start_times[task];
+        s.run_times[task] = run_time;
+        s.sub_devices[task] = sub_device;
+        if (s.replay_end_times[task] != s.end_times[task])
+        {
+            s.end_times[task] = s.replay_end_times[task];
+            s.set_end_time(task, s.end_times[task]);
+        }
+    }
+    sim_time = s.get_sim_time();
+    phase.stop();
+    if (profile != nullptr)
+    {
+        profile->add_count("resimulations", 1);
+        profile->add_count("replayed_events", s.replay_order.size());
+        profile->add_queue_stats(ready_queue->stats);
+        ready_queue->stats = ReadyQueue::Stats();
+    }
+    return sim_time;
+}
@@ -0,0 +1,487 @@
+#include "simulator.h"
+#include <algorithm>
+#include <tuple>
+
+using namespace std;
+
+// Iteration folding.
+//
+// A training trace repeats the same iteration many times: the same ops on the same devices with
+// the same dependencies, only the measured costs differ. detect() finds the iterations from the
+// labels of the tasks, their op kind and device. A label that occurs r * num_iterations times has
+// r tasks in every iteration, and its occurrences in the order of the task ids, which is the order
+// of the trace, are split into consecutive groups of r. The candidate numbers of iterations are
+// the counts of the labels, tried from the one that puts the most tasks after the first iteration.
+// A split is kept when the edges agree with it: an edge from iteration i to iteration i + d must
+// occur between the same positions for every i, the prologue feeds the first or every iteration,
+// the last or every iteration feeds the epilogue, and the epilogue never feeds the loop.
+//
+// simulate_folded() simulates the prologue, the first iterations and the epilogue, doubling the
+// number of simulated iterations until the last half of them take the same time per iteration
+// within the tolerance. The other iterations are extrapolated with the mean time per iteration of
+// that half, which delays the epilogue. The error bound adds the variation of the time per
+// iteration over the extrapolated iterations and the change of their work, the load of the
+// busiest device compared with its mean over the steady iterations. It is an estimate, list
+// scheduling has no exact bound.
+
+namespace
+{
+
+const int MIN_SIMULATED_ITERATIONS = 4;
+const task_id_t NO_TASK = UINT32_MAX;
+const uint32_t NO_POSITION = UINT32_MAX;
+const uint32_t NO_LABEL = UINT32_MAX;
+
+// end of every iteration of a truncated graph
+class IterationSink : public TraceSink
+{
+public:
+    IterationSink(IterationFolding const &folding, int num_iterations)
+        : folding(folding), end_times(num_iterations, 0)
+    {
+    }
+    void record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time)
+    {
+        int iteration = folding.iterations[task->id];
+        if (iteration != IterationFolding::NOT_IN_LOOP)
+        {
+            end_times[iteration] = max(end_times[iteration], end_time);
+        }
+    }
+    IterationFolding const &folding;
+    vector<simtime_t> end_times;
+};
+
+// Split the labels that occur a multiple of num_iterations times over the iterations and check the
+// edges, see above. Fills the loop of the folding and returns whether the split holds.
+bool split(IterationFolding &folding, TaskGraph const &graph, vector<uint32_t> const &labels,
+           vector<uint32_t> const &occurrences, vector<uint32_t> const &counts, int num_iterations)
+{
+    size_t num_tasks = graph.num_tasks();
+    int k = num_iterations;
+    // most wrong splits have an edge back to an earlier iteration, which shows up early in the
+    // order of the trace, so look for one before filling the loop
+    auto iteration_of = [&](task_id_t task) {
+        uint32_t count = counts[labels[task]];
+        return count % k == 0 ? (int)(occurrences[task] / (count / k)) : IterationFolding::NOT_IN_LOOP;
+    };
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        int iteration = iteration_of(i);
+        if (iteration == IterationFolding::NOT_IN_LOOP)
+        {
+            continue;
+        }
+        for (uint32_t j = graph.next_offsets[i]; j < graph.next_offsets[i + 1]; j++)
+        {
+            int next_iteration = iteration_of(graph.next_tasks[j]);
+            if (next_iteration != IterationFolding::NOT_IN_LOOP and next_iteration < iteration)
+            {
+                return false;
+            }
+        }
+    }
+    folding.num_iterations = k;
+    folding.iteration_size = 0;
+    folding.iterations.assign(num_tasks, IterationFolding::NOT_IN_LOOP);
+    folding.positions.assign(num_tasks, NO_POSITION);
+    folding.last_edges.clear();
+    // the tasks of a label take consecutive positions
+    vector<uint32_t> label_positions(counts.size(), NO_POSITION);
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        if (counts[i] % k == 0)
+        {
+            label_positions[i] = folding.iteration_size;
+            folding.iteration_size += counts[i] / k;
+        }
+    }
+    folding.loop_tasks.assign(folding.iteration_size * k, NO_TASK);
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        uint32_t label = labels[i];
+        if (label_positions[label] != NO_POSITION)
+        {
+            uint32_t r = counts[label] / k;
+            folding.iterations[i] = occurrences[i] / r;
+            folding.positions[i] = label_positions[label] + occurrences[i] % r;
+            folding.loop_tasks[folding.iterations[i] * folding.iteration_size + folding.positions[i]] = i;
+        }
+    }
+    vector<int> const &iterations = folding.iterations;
+    vector<uint32_t> const &positions = folding.positions;
+
+    // The loop edges of a task, as the positions and the iteration distances of their ends, must
+    // be those of its position in the first iteration that stay in the loop.
+    auto loop_edges = [&](task_id_t task, int max_distance, vector<pair<uint32_t, int> > &ret) {
+        ret.clear();
+        for (uint32_t j = graph.next_offsets[task]; j < graph.next_offsets[task + 1]; j++)
+        {
+            task_id_t next = graph.next_tasks[j];
+            int distance = iterations[next] - iterations[task];
+            if (iterations[next] != IterationFolding::NOT_IN_LOOP and distance < max_distance)
+            {
+                ret.push_back(make_pair(positions[next], distance));
+            }
+        }
+        sort(ret.begin(), ret.end());
+    };
+    vector<pair<uint32_t, int> > first_edges, cur_edges;
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        if (iterations[i] <= 0)
+        {
+            continue;
+        }
+        loop_edges(i, k, cur_edges);
+        loop_edges(folding.loop_tasks[positions[i]], k - iterations[i], first_edges);
+        if (first_edges != cur_edges)
+        {
+            return false;
+        }
+    }
+
+    // the epilogue: the tasks after the loop, which must not feed it
+    vector<char> after_loop(num_tasks, 0);
+    vector<task_id_t> stack;
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        if (iterations[i] == IterationFolding::NOT_IN_LOOP)
+        {
+            continue;
+        }
+        for (uint32_t j = graph.next_offsets[i]; j < graph.next_offsets[i + 1]; j++)
+        {
+            task_id_t next = graph.next_tasks[j];
+            if (iterations[next] == IterationFolding::NOT_IN_LOOP and !after_loop[next])
+            {
+                after_loop[next] = 1;
+                stack.push_back(next);
+            }
+        }
+    }
+    while (!stack.empty())
+    {
+        task_id_t task = stack.back();
+        stack.pop_back();
+        for (uint32_t j = graph.next_offsets[task]; j < graph.next_offsets[task + 1]; j++)
+        {
+            task_id_t next = graph.next_tasks[j];
+            if (iterations[next] != IterationFolding::NOT_IN_LOOP)
+            {
+                return false;
+            }
+            if (!after_loop[next])
+            {
+                after_loop[next] = 1;
+                stack.push_back(next);
+            }
+        }
+    }
+
+    // The edges between the loop and the other tasks, as the other task, the position and the
+    // iteration. The prologue feeds a position in the first or in every iteration, and a position
+    // in the last or in every iteration feeds the epilogue.
+    vector<tuple<task_id_t, uint32_t, int> > prologue_edges, epilogue_edges;
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        for (uint32_t j = graph.next_offsets[i]; j < graph.next_offsets[i + 1]; j++)
+        {
+            task_id_t next = graph.next_tasks[j];
+            if (iterations[i] == IterationFolding::NOT_IN_LOOP and iterations[next] != IterationFolding::NOT_IN_LOOP)
+            {
+                prologue_edges.push_back(make_tuple((task_id_t)i, positions[next], iterations[next]));
+            }
+            else if (iterations[i] != IterationFolding::NOT_IN_LOOP and iterations[next] == IterationFolding::NOT_IN_LOOP)
+            {
+                epilogue_edges.push_back(make_tuple(next, positions[i], iterations[i]));
+            }
+        }
+    }
+    // whether the edges of each class, the same task and position, start or end in the given
+    // iteration only or the same number of times in every iteration, with the iterations sorted
+    auto check = [&](vector<tuple<task_id_t, uint32_t, int> > &edges, int iteration, bool is_epilogue) {
+        sort(edges.begin(), edges.end());
+        for (size_t begin = 0, end = 0; begin < edges.size(); begin = end)
+        {
+            while (end < edges.size() and get<0>(edges[end]) == get<0>(edges[begin]) and
+                   get<1>(edges[end]) == get<1>(edges[begin]))
+            {
+                end++;
+            }
+            size_t n = end - begin;
+            if (get<2>(edges[begin]) == iteration and get<2>(edges[end - 1]) == iteration)
+            {
+                for (size_t i = begin; is_epilogue and i < end; i++)
+                {
+                    task_id_t task = folding.loop_tasks[iteration * folding.iteration_size + get<1>(edges[i])];
+                    folding.last_edges.push_back(make_pair(task, get<0>(edges[i])));
+                }
+                continue;
+            }
+            if (n % k != 0)
+            {
+                return false;
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                if ((size_t)get<2>(edges[begin + i]) != i / (n / k))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+    return check(prologue_edges, 0, false) and check(epilogue_edges, k - 1, true);
+}
+
+} // namespace
+
+// class IterationFolding
+const int IterationFolding::NOT_IN_LOOP;
+
+bool IterationFolding::detect(TaskGraph const &graph)
+{
+    assert(graph.finalized());
+    size_t num_tasks = graph.num_tasks();
+    // label of each task and its occurrence among the tasks of the label
+    int num_devices = graph.machine->get_num_devices();
+    unordered_map<string const *, uint32_t> kinds; // interned, by address
+    vector<uint32_t> label_ids; // by kind and device
+    vector<uint32_t> labels(num_tasks);
+    vector<uint32_t> occurrences(num_tasks);
+    vector<uint32_t> counts;
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        string const *name = graph.tasks[i]->kind;
+        // the communication tasks have no kind
+        size_t kind = name == nullptr ? 0 : kinds.insert(make_pair(name, (uint32_t)kinds.size() + 1)).first->second;
+        if (kind >= label_ids.size() / num_devices)
+        {
+            label_ids.resize((kind + 1) * num_devices, NO_LABEL);
+        }
+        uint32_t &label = label_ids[kind * num_devices + graph.devices[i]->index];
+        if (label == NO_LABEL)
+        {
+            label = counts.size();
+            counts.push_back(0);
+        }
+        labels[i] = label;
+        occurrences[i] = counts[label]++;
+    }
+
+    // The candidates are the divisors of the counts, several points of an op may share a device.
+    // They are tried by the number of tasks after the first iteration, the larger first on a tie.
+    vector<uint32_t> values;
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        for (uint32_t j = 1; j * j <= counts[i]; j++)
+        {
+            if (counts[i] % j == 0)
+            {
+                values.push_back(j);
+                values.push_back(counts[i] / j);
+            }
+        }
+    }
+    sort(values.begin(), values.end());
+    values.erase(unique(values.begin(), values.end()), values.end());
+    vector<pair<uint64_t, uint32_t> > candidates;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        if (values[i] < 2)
+        {
+            continue;
+        }
+        uint64_t num_loop_tasks = 0;
+        for (size_t j = 0; j < counts.size(); j++)
+        {
+            num_loop_tasks += counts[j] % values[i] == 0 ? counts[j] : 0;
+        }
+        candidates.push_back(make_pair(num_loop_tasks - num_loop_tasks / values[i], values[i]));
+    }
+    sort(candidates.rbegin(), candidates.rend());
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        if (split(*this, graph, labels, occurrences, counts, candidates[i].second))
+        {
+            return true;
+        }
+    }
+    num_iterations = 0;
+    iteration_size = 0;
+    iterations.assign(num_tasks, NOT_IN_LOOP);
+    positions.clear();
+    loop_tasks.clear();
+    last_edges.clear();
+    return false;
+}
+
+void IterationFolding::truncate(TaskGraph const &graph, int num_iterations, TaskGraph &ret) const
+{
+    assert(num_iterations >= 1 and num_iterations <= this->num_iterations);
+    size_t num_tasks = graph.num_tasks();
+    ret.clear();
+    ret.machine = graph.machine;
+    vector<task_id_t> ids(num_tasks, NO_TASK);
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        if (iterations[i] < num_iterations)
+        {
+            ids[i] = ret.tasks.size();
+            ret.tasks.push_back(graph.tasks[i]);
+            ret.devices.push_back(graph.devices[i]);
+            ret.costs.push_back(graph.costs[i]);
+            ret.num_prev_tasks.push_back(0);
+        }
+    }
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        if (ids[i] == NO_TASK)
+        {
+            continue;
+        }
+        for (uint32_t j = graph.next_offsets[i]; j < graph.next_offsets[i + 1]; j++)
+        {
+            if (ids[graph.next_tasks[j]] != NO_TASK)
+            {
+                ret.add_edge(ids[i], ids[graph.next_tasks[j]]);
+            }
+        }
+    }
+    if (num_iterations < this->num_iterations)
+    {
+        for (size_t i = 0; i < last_edges.size(); i++)
+        {
+            task_id_t task = loop_tasks[(num_iterations - 1) * iteration_size + positions[last_edges[i].first]];
+            ret.add_edge(ids[task], ids[last_edges[i].second]);
+        }
+    }
+    for (size_t i = 0; i < graph.start_tasks.size(); i++)
+    {
+        if (ids[graph.start_tasks[i]] != NO_TASK)
+        {
+            ret.start_tasks.push_back(ids[graph.start_tasks[i]]);
+        }
+    }
+    ret.finalize();
+}
+
+// class Simulator
+void Simulator::simulate_folded(TaskGraph const &graph)
+{
+    ProfilePhase phase(profile, "fold_iterations");
+    IterationFolding folding;
+    bool folded = folding.detect(graph);
+    phase.stop();
+    num_iterations = 0;
+    num_simulated_iterations = 0;
+    iteration_time = 0;
+    fold_error_bound = 0;
+    if (!folded)
+    {
+        simulate(graph);
+        return;
+    }
+
+    int k = folding.num_iterations;
+    TraceSink *saved_trace_sink = trace_sink;
+    bool saved_print_summary = print_summary;
+    print_summary = false;
+    TaskGraph truncated;
+    int num_steady = 0;
+    simtime_t spread = 0;
+    for (int w = min(k, MIN_SIMULATED_ITERATIONS);; w = min(k, 2 * w))
+    {
+        folding.truncate(graph, w, truncated);
+        IterationSink sink(folding, w);
+        trace_sink = &sink;
+        simulate(truncated);
+        num_simulated_iterations = w;
+        // time per iteration over the last half of the simulated iterations
+        num_steady = min(w - 1, max(2, w / 2));
+        vector<simtime_t> const &end_times = sink.end_times;
+        iteration_time = num_steady > 0 ? (end_times[w - 1] - end_times[w - 1 - num_steady]) / num_steady : 0;
+        spread = 0;
+        for (int i = w - num_steady; i < w; i++)
+        {
+            simtime_t time = end_times[i] - end_times[i - 1];
+            spread = max(spread, time > iteration_time ? time - iteration_time : iteration_time - time);
+        }
+        if (w == k or spread <= fold_tolerance * iteration_time)
+        {
+            break;
+        }
+    }
+    trace_sink = saved_trace_sink;
+    print_summary = saved_print_summary;
+
+    // the totals of the whole graph are the sums of its costs
+    RunState full;
+    full.init(graph, machine);
+    total_comp_time = 0;
+    total_comm_time = 0;
+    total_simulated_comp_tasks = 0;
+    for (size_t i = 0; i < graph.num_tasks(); i++)
+    {
+        if (full.devices[i]->type == Device::DEVICE_COMP)
+        {
+            total_comp_time += full.costs[i];
+            total_simulated_comp_tasks++;
+        }
+        else
+        {
+            total_comm_time += full.costs[i];
+        }
+    }
+
+    int w = num_simulated_iterations;
+    num_iterations = k;
+    if (w < k)
+    {
+        // load of the busiest device in each iteration
+        int num_devices = machine->get_num_devices();
+        vector<simtime_t> device_loads((size_t)k * num_devices, 0);
+        for (size_t i = 0; i < graph.num_tasks(); i++)
+        {
+            if (folding.iterations[i] != IterationFolding::NOT_IN_LOOP)
+            {
+                device_loads[(size_t)folding.iterations[i] * num_devices + full.devices[i]->index] += full.costs[i];
+            }
+        }
+        vector<simtime_t> loads(k, 0);
+        for (int i = 0; i < k; i++)
+        {
+            for (int j = 0; j < num_devices; j++)
+            {
+                loads[i] = max(loads[i], device_loads[(size_t)i * num_devices + j] /
+                                             machine->get_device(j)->max_sub_device);
+            }
+        }
+        simtime_t steady_load = 0;
+        for (int i = w - num_steady; i < w; i++)
+        {
+            steady_load += loads[i];
+        }
+        steady_load /= num_steady;
+        fold_error_bound = (k - w) * spread;
+        for (int i = w; i < k; i++)
+        {
+            fold_error_bound += loads[i] > steady_load ? loads[i] - steady_load : steady_load - loads[i];
+        }
+        sim_time += (k - w) * iteration_time;
+    }
+    if (profile != nullptr)
+    {
+        profile->add_count("folded_iterations", k - w);
+    }
+    if (!print_summary)
+    {
+        return;
+    }
+    cout << "folded_iterations " << k << " simulated " << w << " iteration_time " << to_ms(iteration_time)
+         << "ms error_bound " << to_ms(fold_error_bound) << "ms" << endl;
+    print_totals();
+}
@@ -1,6 +1,106 @@
 #include "simulator.h"
+#include <algorithm>
 #include <fstream> // std::ifstream
 
+MachineModel::MachineModel()
+    : num_route_choices(1), route_choice(0)
+{
+}
+
+MachineModel::~MachineModel()
+{
+  for (size_t i = 0; i < devices.size(); i++)
+  {
+    delete devices[i];
+  }
+}
+
+int MachineModel::get_num_devices() const
+{
+  return devices.size();
+}
+
+int MachineModel::get_num_sub_devices() const
+{
+  return sub_devices.size();
+}
+
+Device *MachineModel::get_device(int index) const
+{
+  return devices[index];
+}
+
+SubDevice *MachineModel::get_sub_device(int index) const
+{
+  return sub_devices[index];
+}
+
+CommPath MachineModel::get_comm_path(MemDevice *src_mem, MemDevice *tar_mem)
+{
+  Route const &route = lookup_route(src_mem, tar_mem);
+  int choice = route.num_choices > 1 ? route_choice : 0;
+  route_choice = (route_choice + route.num_steps) % num_route_choices;
+  return CommPath(route_devices[route.index].data() + choice * route.length, route.length);
+}
+
+CommPath MachineModel::peek_comm_path(MemDevice *src_mem, MemDevice *tar_mem)
+{
+  Route const &route = lookup_route(src_mem, tar_mem);
+  int choice = route.num_choices > 1 ? route_choice : 0;
+  return CommPath(route_devices[route.index].data() + choice * route.length, route.length);
+}
+
+MachineModel::Route const &MachineModel::lookup_route(MemDevice *src_mem, MemDevice *tar_mem)
+{
+  if (routes.size() != mems.size() * mems.size())
+  {
+    routes.assign(mems.size() * mems.size(), Route());
+  }
+  Route &route = routes[src_mem->mem_index * mems.size() + tar_mem->mem_index];
+  if (route.num_choices == 0)
+  {
+    find_route(src_mem, tar_mem, route);
+  }
+  return route;
+}
+
+void MachineModel::restart_round_robin()
+{
+  route_choice = 0;
+}
+
+void MachineModel::find_route(MemDevice *src_mem, MemDevice *tar_mem, Route &route)
+{
+  int cur_choice = route_choice;
+  route.index = route_devices.size();
+  route_devices.emplace_back();
+  std::vector<CommDevice *> &devices = route_devices.back();
+  for (int choice = 0; choice < num_route_choices; choice++)
+  {
+    route_choice = choice;
+    size_t length = devices.size();
+    find_comm_path(src_mem, tar_mem, devices);
+    if (choice == 0)
+    {
+      route.length = devices.size();
+      route.num_steps = route_choice;
+    }
+    assert(devices.size() - length == route.length);
+  }
+  route_choice = cur_choice;
+  // keep one choice of a route that takes no link chosen round robin
+  route.num_choices = num_route_choices;
+  for (int choice = 1; choice < num_route_choices; choice++)
+  {
+    if (!std::equal(devices.begin(), devices.begin() + route.length, devices.begin() + choice * route.length))
+    {
+      return;
+    }
+  }
+  route.num_choices = 1;
+  devices.resize(route.length);
+}
+
 SimpleMachineModel::SimpleMachineModel(int num_nodes, int num_cpus_per_node, int num_gpus_per_node)
 {
   version = 0;
@@ -21,12 +121,12 @@ SimpleMachineModel::SimpleMachineModel(int num_nodes, int num_cpus_per_node, int
   {
     // add system memory
     std::string sys_mem_name = "SYSTEM_MEM " + std::to_string(i);
-    id_to_sys_mem[i] = new MemDevice(sys_mem_name, MemDevice::SYSTEM_MEM, i, i, i);
+    id_to_sys_mem[i] = add_device(new MemDevice(sys_mem_name, MemDevice::SYSTEM_MEM, i, i, i));
     for (int j = 0; j < num_cpus_per_node; j++)
     {
       int device_id = i * num_cpus_per_node + j;
       std::string cpu_name = "CPU " + std::to_string(device_id);
-      id_to_cpu[device_id] = new CompDevice(cpu_name, CompDevice::LOC_PROC, i, i, device_id, 1);
+      id_to_cpu[device_id] = add_device(new CompDevice(cpu_name, CompDevice::LOC_PROC, i, i, device_id, 1));
     }
   }
 
@@ -37,9 +137,9 @@ SimpleMachineModel::SimpleMachineModel(int num_nodes, int num_cpus_per_node, int
     {
       int device_id = i * num_gpus_per_node + j;
       std::string gpu_name = "GPU " + std::to_string(device_id);
-      id_to_gpu[device_id] = new CompDevice(gpu_name, CompDevice::TOC_PROC, i, i, device_id, 1);
+      id_to_gpu[device_id] = add_device(new CompDevice(gpu_name, CompDevice::TOC_PROC, i, i, device_id, 1));
       std::string gpu_mem_name = "GPU_FB_MEM " + std::to_string(device_id);
-      id_to_gpu_fb_mem[device_id] = new MemDevice(gpu_mem_name, MemDevice::GPU_FB_MEM, i, i, device_id);
+      id_to_gpu_fb_mem[device_id] = add_device(new MemDevice(gpu_mem_name, MemDevice::GPU_FB_MEM, i, i, device_id));
     }
   }
 
@@ -54,7 +154,7 @@ SimpleMachineModel::SimpleMachineModel(int num_nodes, int num_cpus_per_node, int
       {
         int device_id = i * num_gpus + j;
         std::string nvlink_name = "NVLINK " + std::to_string(device_id);
-        ids_to_inter_gpu_comm_device[device_id] = new CommDevice(nvlink_name, CommDevice::NVLINK_COMM, src->node_id, src->node_id, device_id, 0, inter_gpu_bandwidth);
+        ids_to_inter_gpu_comm_device[device_id] = add_device(new CommDevice(nvlink_name, CommDevice::NVLINK_COMM, src->node_id, src->node_id, device_id, 0, inter_gpu_bandwidth));
       }
     }
   }
@@ -64,9 +164,9 @@ SimpleMachineModel::SimpleMachineModel(int num_nodes, int num_cpus_per_node, int
   {
     int node_id = num_gpus / num_gpus_per_node;
     std::string pci_to_host_name = "PCI_TO_HOST " + std::to_string(i);
-    id_to_gputodram_comm_device[i] = new CommDevice(pci_to_host_name, CommDevice::PCI_TO_HOST_COMM, node_id, node_id, i, 0, gpu_dram_bandwidth);
+    id_to_gputodram_comm_device[i] = add_device(new CommDevice(pci_to_host_name, CommDevice::PCI_TO_HOST_COMM, node_id, node_id, i, 0, gpu_dram_bandwidth));
     std::string pci_to_dev_name = "PCI_TO_DEV " + std::to_string(i);
-    id_to_dramtogpu_comm_device[i] = new CommDevice(pci_to_dev_name, CommDevice::PCI_TO_DEV_COMM, node_id, node_id, i, 0, gpu_dram_bandwidth);
+    id_to_dramtogpu_comm_device[i] = add_device(new CommDevice(pci_to_dev_name, CommDevice::PCI_TO_DEV_COMM, node_id, node_id, i, 0, gpu_dram_bandwidth));
   }
 
   // Create inter node comm devices
@@ -78,7 +178,7 @@ SimpleMachineModel::SimpleMachineModel(int num_nodes, int num_cpus_per_node, int
       {
         int device_id = i * num_nodes + j;
         std::string nic_name = "NIC " + std::to_string(device_id);
-        ids_to_inter_node_comm_device[device_id] = new CommDevice(nic_name, CommDevice::NIC_OUT_COMM, -1, -1, device_id, 0, inter_node_bandwidth);
+        ids_to_inter_node_comm_device[device_id] = add_device(new CommDevice(nic_name, CommDevice::NIC_OUT_COMM, -1, -1, device_id, 0, inter_node_bandwidth));
       }
     }
   }
@@ -139,19 +239,18 @@ float SimpleMachineModel::get_inter_node_gpu_bandwidth() const
   return inter_node_bandwidth;
 }
 
-std::vector<CommDevice *> SimpleMachineModel::get_comm_path(MemDevice *src_mem, MemDevice *tar_mem)
+void SimpleMachineModel::find_comm_path(MemDevice *src_mem, MemDevice *tar_mem, std::vector<CommDevice *> &ret)
 {
-  std::vector<CommDevice *> ret;
   // on the same memory
   if (src_mem->mem_type == tar_mem->mem_type and src_mem->device_id == tar_mem->device_id)
   {
-    return ret;
+    return;
   }
   if (src_mem->mem_type == MemDevice::SYSTEM_MEM and tar_mem->mem_type == MemDevice::SYSTEM_MEM)
   {
     if (src_mem->node_id == tar_mem->node_id)
     {
-      return ret;
+      return;
     }
     else
     {
@@ -205,7 +304,6 @@ std::vector<CommDevice *> SimpleMachineModel::get_comm_path(MemDevice *src_mem,
     printf("No path found between %s and %s\n", src_mem->name.c_str(), tar_mem->name.c_str());
     assert(false);
   }
-  return ret;
 }
 
 std::string SimpleMachineModel::to_string() const
@@ -253,11 +351,12 @@ int SimpleMachineModel::get_num_gpus_per_socket() const
   return num_gpus_per_node;
 }
 
-EnhancedMachineModel::EnhancedMachineModel(std::string file)
+EnhancedMachineModel::EnhancedMachineModel(std::string file, std::unordered_map<std::string, std::string> const &overrides)
 {
   version = 1;
   std::ifstream machine_config(file);
   std::string line;
+  size_t num_overridden = 0;
   while (std::getline(machine_config, line))
   {
     if (line[0] != '#')
@@ -265,6 +364,12 @@ EnhancedMachineModel::EnhancedMachineModel(std::string file)
       // split a line into words
       std::istringstream iss(line);
       std::vector<std::string> words{std::istream_iterator<std::string>{iss}, std::istream_iterator<std::string>{}};
+      if (words.size() >= 3 and overrides.find(words[0]) != overrides.end())
+      {
+        words.resize(3);
+        words[2] = overrides.at(words[0]);
+        num_overridden++;
+      }
       if (words.size() >= 3)
       {
         if (words[0] == "num_nodes")
@@ -292,6 +397,27 @@ EnhancedMachineModel::EnhancedMachineModel(std::string file)
           num_cudastream_per_gpu = stoi(words[2]);
           printf("num_cudastream_per_gpu = %d\n", num_cudastream_per_gpu);
         }
+        else if (words[0] == "cudastream_policy")
+        {
+          if (words[2] == "round_robin")
+          {
+            cudastream_policy = Device::ROUND_ROBIN;
+          }
+          else if (words[2] == "earliest_free")
+          {
+            cudastream_policy = Device::EARLIEST_FREE;
+          }
+          else if (words[2] == "least_loaded")
+          {
+            cudastream_policy = Device::LEAST_LOADED;
+          }
+          else
+          {
+            printf("Unknown cudastream_policy %s\n", words[2].c_str());
+            assert(false);
+          }
+          printf("cudastream_policy = %s\n", words[2].c_str());
+        }
         else if (words[0] == "membus_latency")
         {
           membus_latency = stof(words[2]);
@@ -357,6 +483,21 @@ EnhancedMachineModel::EnhancedMachineModel(std::string file)
           nvlink_version = stoi(words[2]);
           printf("nvlink_version = %d\n", nvlink_version);
         }
+        else if (words[0] == "sys_mem_capacity")
+        {
+          sys_mem_capacity = stod(words[2]) * (1 << 30);
+          printf("sys_mem_capacity = %sGB\n", words[2].c_str());
+        }
+        else if (words[0] == "z_copy_mem_capacity")
+        {
+          z_copy_mem_capacity = stod(words[2]) * (1 << 30);
+          printf("z_copy_mem_capacity = %sGB\n", words[2].c_str());
+        }
+        else if (words[0] == "gpu_fb_mem_capacity")
+        {
+          gpu_fb_mem_capacity = stod(words[2]) * (1 << 30);
+          printf("gpu_fb_mem_capacity = %sGB\n", words[2].c_str());
+        }
         else if (words[0] == "intra_socket_sys_mem_to_sys_mem")
         {
           printf("intra_socket_sys_mem_to_sys_mem = ");
@@ -481,10 +622,16 @@ EnhancedMachineModel::EnhancedMachineModel(std::string file)
     }
   }
 
+  if (num_overridden != overrides.size())
+  {
+    printf("machine config %s: some of the %zu overrides are not in the file\n", file.c_str(), overrides.size());
+  }
+
   num_sockets = num_nodes * num_sockets_per_node;
   num_cpus = num_sockets * num_cpus_per_socket;
   num_gpus = num_sockets * num_gpus_per_socket;
-  cur_nic_local_id = 0;
+  num_route_choices = nic_persocket > 0 ? nic_persocket : 1;
+  route_choice = 0;
   num_nvlinks_per_node = 0;
   mem_to_nvlink.clear();
   this->add_cpus();
@@ -546,7 +693,8 @@ void EnhancedMachineModel::add_cpus()
       int device_id = socket_id;
       // add system memory
       std::string sys_mem_name = "SYSTEM_MEM " + std::to_string(device_id);
-      MemDevice *sys_mem = new MemDevice(sys_mem_name, MemDevice::SYSTEM_MEM, node_id, socket_id, device_id);
+      MemDevice *sys_mem = add_device(new MemDevice(sys_mem_name, MemDevice::SYSTEM_MEM, node_id, socket_id, device_id));
+      sys_mem->capacity = sys_mem_capacity;
       sys_mems.emplace_back(sys_mem);
       // add cpus
       cpus.push_back({});
@@ -554,7 +702,7 @@ void EnhancedMachineModel::add_cpus()
       {
         device_id = socket_id * num_cpus_per_socket + k;
         std::string cpu_name = "CPU " + std::to_string(device_id);
-        cpus[socket_id].emplace_back(new CompDevice(cpu_name, CompDevice::LOC_PROC, node_id, socket_id, device_id, 1));
+        cpus[socket_id].emplace_back(add_device(new CompDevice(cpu_name, CompDevice::LOC_PROC, node_id, socket_id, device_id, 1)));
       }
     }
   }
@@ -571,7 +719,8 @@ void EnhancedMachineModel::add_gpus()
       int device_id = socket_id;
       // add zero copy memory
       std::string z_copy_mem_name = "Z_COPY_MEM " + std::to_string(device_id);
-      MemDevice *z_copy_mem = new MemDevice(z_copy_mem_name, MemDevice::Z_COPY_MEM, node_id, socket_id, device_id);
+      MemDevice *z_copy_mem = add_device(new MemDevice(z_copy_mem_name, MemDevice::Z_COPY_MEM, node_id, socket_id, device_id));
+      z_copy_mem->capacity = z_copy_mem_capacity;
       z_copy_mems.push_back(z_copy_mem);
       // add gpus and gpu framebuffer memories
       gpus.push_back({});
@@ -580,9 +729,11 @@ void EnhancedMachineModel::add_gpus()
       {
         device_id = socket_id * num_gpus_per_socket + k;
         std::string gpu_name = "GPU " + std::to_string(device_id);
-        gpus[socket_id].push_back(new CompDevice(gpu_name, CompDevice::TOC_PROC, node_id, socket_id, device_id, num_cudastream_per_gpu));
+        gpus[socket_id].push_back(add_device(new CompDevice(gpu_name, CompDevice::TOC_PROC, node_id, socket_id, device_id, num_cudastream_per_gpu)));
+        gpus[socket_id].back()->sub_device_policy = cudastream_policy;
         std::string gpu_mem_name = "GPU_FB_MEM " + std::to_string(device_id);
-        MemDevice *gpu_mem = new MemDevice(gpu_mem_name, MemDevice::GPU_FB_MEM, node_id, socket_id, device_id);
+        MemDevice *gpu_mem = add_device(new MemDevice(gpu_mem_name, MemDevice::GPU_FB_MEM, node_id, socket_id, device_id));
+        gpu_mem->capacity = gpu_fb_mem_capacity;
         gpu_fb_mems[socket_id].push_back({gpu_mem});
       }
     }
@@ -599,7 +750,7 @@ void EnhancedMachineModel::add_membuses(float latency, float bandwidth)
       int socket_id = i * num_sockets_per_node + j;
       int device_id = socket_id;
       std::string membus_name = "MEMBUS " + std::to_string(device_id);
-      CommDevice *membus = new CommDevice(membus_name, CommDevice::MEMBUS_COMM, node_id, socket_id, device_id, latency, bandwidth);
+      CommDevice *membus = add_device(new CommDevice(membus_name, CommDevice::MEMBUS_COMM, node_id, socket_id, device_id, latency, bandwidth));
       membuses.push_back(membus);
     }
   }
@@ -615,10 +766,10 @@ void EnhancedMachineModel::add_upis(float latency, float bandwidth)
       int socket_id = i * num_sockets_per_node + j;
       int device_id = socket_id;
       std::string upi_in_name = "UPI_IN " + std::to_string(device_id);
-      CommDevice *upi_in = new CommDevice(upi_in_name, CommDevice::UPI_IN_COMM, node_id, socket_id, device_id, latency, bandwidth);
+      CommDevice *upi_in = add_device(new CommDevice(upi_in_name, CommDevice::UPI_IN_COMM, node_id, socket_id, device_id, latency, bandwidth));
       upi_ins.push_back(upi_in);
       std::string upi_out_name = "UPI_OUT " + std::to_string(device_id);
-      CommDevice *upi_out = new CommDevice(upi_out_name, CommDevice::UPI_OUT_COMM, node_id, socket_id, device_id, latency, bandwidth);
+      CommDevice *upi_out = add_device(new CommDevice(upi_out_name, CommDevice::UPI_OUT_COMM, node_id, socket_id, device_id, latency, bandwidth));
       upi_outs.push_back(upi_out);
     }
   }
@@ -640,11 +791,11 @@ void EnhancedMachineModel::add_nics(float latency, float bandwidth, int nic_pers
         if (j == 0)
         {
           std::string nic_in_name = "NIC_IN " + std::to_string(device_id);
-          nic_in = new CommDevice(nic_in_name, CommDevice::NIC_IN_COMM, node_id, socket_id, device_id, latency, bandwidth);
+          nic_in = add_device(new CommDevice(nic_in_name, CommDevice::NIC_IN_COMM, node_id, socket_id, device_id, latency, bandwidth));
           nic_ins.push_back({});
           nic_ins[socket_id].push_back(nic_in);
           std::string nic_out_name = "NIC_OUT " + std::to_string(device_id);
-          nic_out = new CommDevice(nic_out_name, CommDevice::NIC_OUT_COMM, node_id, socket_id, device_id, latency, bandwidth);
+          nic_out = add_device(new CommDevice(nic_out_name, CommDevice::NIC_OUT_COMM, node_id, socket_id, device_id, latency, bandwidth));
           nic_outs.push_back({});
           nic_outs[socket_id].push_back(nic_out);
         }
@@ -672,10 +823,10 @@ void EnhancedMachineModel::add_nics(float latency, float bandwidth, int nic_pers
         {
           int device_id = socket_id * nic_persocket + k;
           std::string nic_in_name = "NIC_IN " + std::to_string(device_id);
-          CommDevice *nic_in = new CommDevice(nic_in_name, CommDevice::NIC_IN_COMM, node_id, socket_id, device_id, latency, bandwidth);
+          CommDevice *nic_in = add_device(new CommDevice(nic_in_name, CommDevice::NIC_IN_COMM, node_id, socket_id, device_id, latency, bandwidth));
           nic_ins[socket_id].push_back(nic_in);
           std::string nic_out_name = "NIC_OUT " + std::to_string(device_id);
-          CommDevice *nic_out = new CommDevice(nic_out_name, CommDevice::NIC_OUT_COMM, node_id, socket_id, device_id, latency, bandwidth);
+          CommDevice *nic_out = add_device(new CommDevice(nic_out_name, CommDevice::NIC_OUT_COMM, node_id, socket_id, device_id, latency, bandwidth));
           nic_outs[socket_id].push_back(nic_out);
         }
       }
@@ -697,10 +848,10 @@ void EnhancedMachineModel::add_pcis(float latency, float bandwidth, int pci_pers
       {
         int device_id = socket_id * pci_persocket + k;
         std::string pci_to_host_name = "PCI_TO_HOST " + std::to_string(device_id); // pcie to memory
-        CommDevice *pci_to_host = new CommDevice(pci_to_host_name, CommDevice::PCI_TO_HOST_COMM, node_id, socket_id, device_id, latency, bandwidth);
+        CommDevice *pci_to_host = add_device(new CommDevice(pci_to_host_name, CommDevice::PCI_TO_HOST_COMM, node_id, socket_id, device_id, latency, bandwidth));
         pcis_to_host[socket_id].push_back(pci_to_host);
         std::string pci_to_dev_name = "PCI_TO_DEV " + std::to_string(device_id); // memory to pcie
-        CommDevice *pci_to_dev = new CommDevice(pci_to_dev_name, CommDevice::PCI_TO_DEV_COMM, node_id, socket_id, device_id, latency, bandwidth);
+        CommDevice *pci_to_dev = add_device(new CommDevice(pci_to_dev_name, CommDevice::PCI_TO_DEV_COMM, node_id, socket_id, device_id, latency, bandwidth));
         pcis_to_device[socket_id].push_back(pci_to_dev);
       }
     }
@@ -726,11 +877,11 @@ void EnhancedMachineModel::add_nvlinks(float latency, float bandwidth)
         // optimization for nvlink 1st gen only
         if (j == 2 or j == 4 or j == 7 or j == 9)
         {
-          nvlinks[i].push_back(new CommDevice(nvlink_name, CommDevice::NVLINK_COMM, node_id, socket_id, nvlink_id, latency, bandwidth * 2));
+          nvlinks[i].push_back(add_device(new CommDevice(nvlink_name, CommDevice::NVLINK_COMM, node_id, socket_id, nvlink_id, latency, bandwidth * 2)));
         }
         else
         {
-          nvlinks[i].push_back(new CommDevice(nvlink_name, CommDevice::NVLINK_COMM, node_id, socket_id, nvlink_id, latency, bandwidth));
+          nvlinks[i].push_back(add_device(new CommDevice(nvlink_name, CommDevice::NVLINK_COMM, node_id, socket_id, nvlink_id, latency, bandwidth)));
         }
       }
 
@@ -780,7 +931,7 @@ void EnhancedMachineModel::add_nvlinks(float latency, float bandwidth)
         {
           int nvlink_id = socket_id * num_nvlinks_per_socket * 2 + k;
           std::string nvlink_name = "NVLINK " + std::to_string(nvlink_id);
-          nvlinks[node_id].push_back(new CommDevice(nvlink_name, CommDevice::NVLINK_COMM, node_id, socket_id, nvlink_id, latency, bandwidth));
+          nvlinks[node_id].push_back(add_device(new CommDevice(nvlink_name, CommDevice::NVLINK_COMM, node_id, socket_id, nvlink_id, latency, bandwidth)));
         }
       }
 
@@ -910,13 +1061,13 @@ CommDevice *EnhancedMachineModel::get_next_nic_in(int socket_id)
   }
   if (socket_id < num_sockets)
   {
-    CommDevice *ret = nic_ins[socket_id][cur_nic_local_id];
-    cur_nic_local_id = (cur_nic_local_id + 1) % nic_persocket;
+    CommDevice *ret = nic_ins[socket_id][route_choice];
+    route_choice = (route_choice + 1) % nic_persocket;
     return ret;
   }
   else
   {
-    printf("MachineModel: get_next_nic_in - cannot find next nic_in socket_id %d cur_nic_local_id %d\n", socket_id, cur_nic_local_id);
+    printf("MachineModel: get_next_nic_in - cannot find next nic_in socket_id %d route_choice %d\n", socket_id, route_choice);
     assert(false);
   }
 }
@@ -929,11 +1080,11 @@ CommDevice *EnhancedMachineModel::get_next_nic_out(int socket_id) const
   }
   if (socket_id < num_sockets)
   {
-    return nic_outs[socket_id][cur_nic_local_id];
+    return nic_outs[socket_id][route_choice];
   }
   else
   {
-    printf("MachineModel: get_next_nic_out - cannot find next nic_out socket_id %d cur_nic_local_id %d\n", socket_id, cur_nic_local_id);
+    printf("MachineModel: get_next_nic_out - cannot find next nic_out socket_id %d route_choice %d\n", socket_id, route_choice);
     assert(false);
   }
 }
@@ -1039,9 +1190,8 @@ void EnhancedMachineModel::add_comm_path(std::vector<CommDevice::CommDevType> co
   }
 }
 
-std::vector<CommDevice *> EnhancedMachineModel::get_comm_path(MemDevice *src_mem, MemDevice *tar_mem)
+void EnhancedMachineModel::find_comm_path(MemDevice *src_mem, MemDevice *tar_mem, std::vector<CommDevice *> &ret)
 {
-  std::vector<CommDevice *> ret;
   // if (src_mem->device_id == tar_mem->device_id) {
   //     return ret;
   // }
@@ -1110,7 +1260,6 @@ std::vector<CommDevice *> EnhancedMachineModel::get_comm_path(MemDevice *src_mem
     printf("MachineModel: get_comm_path - no path found between %s and %s\n", src_mem->name.c_str(), tar_mem->name.c_str());
     assert(false);
   }
-  return ret;
 }
 
 float EnhancedMachineModel::get_intra_node_gpu_bandwidth() const
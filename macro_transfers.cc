@@ -0,0 +1,401 @@
+#include "simulator.h"
+#include <algorithm>
+
+using namespace std;
+
+// Macro transfers.
+//
+// The segmented model turns a message into num_segments tasks on every device of its path, and a
+// segment moves to the next device when it is through the previous one. In a device of type
+// NIC_IN or UPI_IN, a segment also holds the next segment on the previous device. A message
+// crossing nodes is up to max_num_segs * 5 tasks, most of the task graph.
+//
+// A macro transfer is the whole message as one task. When it becomes ready, start_transfer()
+// computes the times of all its segments with the recurrence of the segmented model, on the
+// devices as they are at that moment, and reserves each device until the ready time of its last
+// segment there. Its entry in the ready queue moves to the ready time of its last segment, when it
+// finishes like the last segment would. If another task comes to a reserved device before that,
+// the segmented model could run it between the segments: split_transfer() keeps the segments that
+// would have run before the task and turns the others into events of the ready queue, stepped one
+// by one in the order of the segmented model. The ready queue orders the entries of a transfer by
+// its id, which sorts with the other ids like the ids of its segments, so the results are the ones
+// of the segmented model, ties included. A transfer also steps from the start when another one
+// steps on its path. The trace has one record per transfer, from the start of its first segment to
+// the end of its last one, with the run time of all its segments.
+
+namespace
+{
+
+const task_id_t NO_TASK = UINT32_MAX;
+
+// values of transfer_slots for the tasks that are not running
+const uint32_t NOT_TRANSFER = UINT32_MAX;
+const uint32_t NOT_STARTED = UINT32_MAX - 1;
+const uint32_t FINISHED = UINT32_MAX - 2;
+
+// whether a segment on the device holds the next segment on the previous device
+bool holds_next_segment(CommDevice const *device)
+{
+    return device->comm_type == CommDevice::NIC_IN_COMM or device->comm_type == CommDevice::UPI_IN_COMM;
+}
+
+// whether a segment at a ready time runs before a ready queue entry in the segmented model
+bool runs_before(simtime_t ready_time, task_id_t task, ReadyTask const &entry)
+{
+    return ready_time < entry.ready_time or (ready_time == entry.ready_time and task < entry.id);
+}
+
+} // namespace
+
+float CommTask::pipelined_cost(MachineModel const *machine) const
+{
+    vector<float> end_times(path.size(), 0); // end of the last segment on each device
+    for (int j = 0; j < num_segments; j++)
+    {
+        size_t size = j == num_segments - 1 ? message_size - (num_segments - 1) * segment_size : segment_size;
+        float prev_end_time = 0;
+        for (size_t i = 0; i < path.size(); i++)
+        {
+            CommDevice const *device =
+                machine != nullptr ? (CommDevice const *)machine->get_device(path[i]->index) : path[i];
+            float ready_time = prev_end_time;
+            if (j > 0 and i + 1 < path.size() and holds_next_segment(path[i + 1]))
+            {
+                ready_time = max(ready_time, end_times[i + 1]);
+            }
+            end_times[i] = max(ready_time, end_times[i]) + device->latency + size / device->bandwidth;
+            prev_end_time = end_times[i];
+        }
+    }
+    return end_times.back();
+}
+
+void Simulator::simulate_pipelined(TaskGraph const &graph)
+{
+    size_t num_sub_devices = run.sub_device_times.size();
+    reserved_transfers.assign(num_sub_devices, NO_TASK);
+    reserved_times.assign(num_sub_devices, 0);
+    num_stepping_transfers.assign(num_sub_devices, 0);
+    free_transfers.clear();
+    for (size_t i = transfers.size(); i > 0; i--)
+    {
+        free_transfers.push_back(i - 1);
+    }
+    uint64_t num_transfers = 0;
+    transfer_slots.assign(graph.num_tasks(), NOT_TRANSFER);
+    for (size_t i = 0; i < graph.num_tasks(); i++)
+    {
+        if (graph.devices[i]->type == Device::DEVICE_COMM and ((CommTask *)graph.tasks[i])->num_segments > 0)
+        {
+            transfer_slots[i] = NOT_STARTED;
+            num_transfers++;
+        }
+    }
+    for (size_t i = 0; i < graph.start_tasks.size(); i++)
+    {
+        ready_queue->push({0, graph.start_tasks[i]});
+    }
+    while (!ready_queue->empty())
+    {
+        ReadyTask entry = ready_queue->pop();
+        task_id_t cur_task = entry.id;
+        simtime_t end_time;
+        if (transfer_slots[cur_task] != NOT_TRANSFER)
+        {
+            end_time = run_transfer(graph, entry);
+            if (end_time == SIMTIME_MAX)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            SubDevice *cur_sub_device = run.get_avail_sub_device(run.devices[cur_task]);
+            claim_device(cur_sub_device, entry);
+            simtime_t ready_time = run.sub_device_times[cur_sub_device->index];
+            simtime_t start_time = max(ready_time, run.ready_times[cur_task]);
+            simtime_t run_time = run.costs[cur_task];
+            end_time = start_time + run_time;
+            run.sub_device_times[cur_sub_device->index] = end_time;
+            run.sub_device_busy_times[cur_sub_device->index] += run_time;
+            run.sub_device_num_tasks[cur_sub_device->index]++;
+            run.update_sub_device(cur_sub_device);
+            account(graph, cur_task, cur_sub_device, run.ready_times[cur_task], ready_time, start_time, run_time,
+                    end_time);
+        }
+        for (uint32_t i = graph.next_offsets[cur_task]; i < graph.next_offsets[cur_task + 1]; i++)
+        {
+            task_id_t next = graph.next_tasks[i];
+            run.ready_times[next] = max(run.ready_times[next], end_time);
+            run.counters[next]--;
+            if (run.counters[next] == 0)
+            {
+                ready_queue->push({run.ready_times[next], next});
+            }
+        }
+    }
+    if (profile != nullptr)
+    {
+        profile->add_count("macro_transfers", num_transfers);
+    }
+}
+
+simtime_t Simulator::run_transfer(TaskGraph const &graph, ReadyTask const &entry)
+{
+    uint32_t slot = transfer_slots[entry.id];
+    if (slot == NOT_STARTED)
+    {
+        start_transfer(graph, entry);
+        return SIMTIME_MAX;
+    }
+    // split_transfer() leaves the entry of the end of the transfer in the ready queue
+    if (slot == FINISHED or entry.ready_time != transfers[slot].queued_time)
+    {
+        return SIMTIME_MAX;
+    }
+    MacroTransfer &transfer = transfers[slot];
+    size_t num_hops = transfer.sub_devices.size();
+    if (transfer.stepping)
+    {
+        if (!step_transfer(slot, entry))
+        {
+            return SIMTIME_MAX;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < num_hops; i++)
+        {
+            simtime_t busy_time = (transfer.num_segments - 1) * transfer.costs[i] + transfer.costs[num_hops + i];
+            run.sub_device_busy_times[transfer.sub_devices[i]->index] += busy_time;
+            run.sub_device_num_tasks[transfer.sub_devices[i]->index] += transfer.num_segments;
+            transfer.run_time += busy_time;
+        }
+    }
+    // one record from the start of the first segment to the end of the last one, with the time of
+    // all the segments as run time, so the totals are the ones of the segmented model
+    simtime_t end_time = transfer.end_times.back();
+    account(graph, transfer.task, transfer.sub_devices[0], transfer.ready_time, transfer.device_ready_times[0],
+            transfer.start_time, transfer.run_time, end_time);
+    transfer_slots[entry.id] = FINISHED;
+    free_transfers.push_back(slot);
+    return end_time;
+}
+
+void Simulator::start_transfer(TaskGraph const &graph, ReadyTask const &entry)
+{
+    uint32_t slot;
+    if (free_transfers.empty())
+    {
+        slot = transfers.size();
+        transfers.emplace_back();
+    }
+    else
+    {
+        slot = free_transfers.back();
+        free_transfers.pop_back();
+    }
+    transfer_slots[entry.id] = slot;
+    CommTask const *task = (CommTask const *)graph.tasks[entry.id];
+    MacroTransfer &transfer = transfers[slot];
+    size_t num_hops = task->path.size();
+    int num_segments = task->num_segments;
+    size_t last_size = task->message_size - (num_segments - 1) * task->segment_size;
+    transfer.task = entry.id;
+    transfer.ready_time = entry.ready_time;
+    transfer.start_time = entry.ready_time;
+    transfer.run_time = 0;
+    transfer.num_segments = num_segments;
+    transfer.sub_devices.resize(num_hops);
+    transfer.holds_next.resize(num_hops);
+    transfer.costs.resize(2 * num_hops);
+    transfer.device_ready_times.resize(num_hops);
+    transfer.num_run.assign(num_hops, 0);
+    transfer.ready_times.resize(num_hops * num_segments);
+    transfer.end_times.resize(num_hops * num_segments);
+    transfer.stepping = false;
+    for (size_t i = 0; i < num_hops; i++)
+    {
+        // the same costs as the segments, see CommTask::cost()
+        CommDevice *device = (CommDevice *)machine->get_device(task->path[i]->index);
+        transfer.sub_devices[i] = device->sub_devices[0];
+        transfer.holds_next[i] = holds_next_segment(device);
+        transfer.costs[i] = to_simtime(device->latency + task->segment_size / device->bandwidth);
+        transfer.costs[num_hops + i] = to_simtime(device->latency + last_size / device->bandwidth);
+        claim_device(transfer.sub_devices[i], entry);
+        transfer.device_ready_times[i] = run.sub_device_times[transfer.sub_devices[i]->index];
+        transfer.stepping = transfer.stepping or num_stepping_transfers[transfer.sub_devices[i]->index] > 0;
+    }
+    if (transfer.stepping)
+    {
+        for (size_t i = 0; i < num_hops; i++)
+        {
+            num_stepping_transfers[transfer.sub_devices[i]->index]++;
+        }
+        transfer.queued_time = entry.ready_time;
+        ready_queue->push({transfer.queued_time, entry.id});
+        if (profile != nullptr)
+        {
+            profile->add_count("stepped_transfers", 1);
+        }
+        return;
+    }
+    for (int j = 0; j < num_segments; j++)
+    {
+        simtime_t prev_end_time = entry.ready_time;
+        for (size_t i = 0; i < num_hops; i++)
+        {
+            int index = transfer.sub_devices[i]->index;
+            simtime_t ready_time = prev_end_time;
+            if (j > 0 and i + 1 < num_hops and transfer.holds_next[i + 1])
+            {
+                ready_time = max(ready_time, transfer.end_times[(i + 1) * num_segments + j - 1]);
+            }
+            simtime_t start_time = max(ready_time, run.sub_device_times[index]);
+            if (i == 0 and j == 0)
+            {
+                transfer.start_time = start_time;
+            }
+            run.sub_device_times[index] =
+                start_time + (j == num_segments - 1 ? transfer.costs[num_hops + i] : transfer.costs[i]);
+            transfer.ready_times[i * num_segments + j] = ready_time;
+            transfer.end_times[i * num_segments + j] = run.sub_device_times[index];
+            prev_end_time = run.sub_device_times[index];
+        }
+    }
+    for (size_t i = 0; i < num_hops; i++)
+    {
+        int index = transfer.sub_devices[i]->index;
+        run.update_sub_device(transfer.sub_devices[i]);
+        reserved_transfers[index] = entry.id;
+        reserved_times[index] = transfer.ready_times[(i + 1) * num_segments - 1];
+    }
+    transfer.queued_time = transfer.ready_times.back();
+    ready_queue->push({transfer.queued_time, entry.id});
+}
+
+void Simulator::claim_device(SubDevice const *sub_device, ReadyTask const &entry)
+{
+    task_id_t owner = reserved_transfers[sub_device->index];
+    if (owner != NO_TASK and owner != entry.id and !runs_before(reserved_times[sub_device->index], owner, entry))
+    {
+        split_transfer(transfer_slots[owner], entry);
+    }
+}
+
+void Simulator::split_transfer(uint32_t slot, ReadyTask const &entry)
+{
+    MacroTransfer &transfer = transfers[slot];
+    size_t num_hops = transfer.sub_devices.size();
+    int num_segments = transfer.num_segments;
+    transfer.stepping = true;
+    for (size_t i = 0; i < num_hops; i++)
+    {
+        // the segments that ran before the entry are the ones of the segmented model, no other
+        // task came to their devices
+        int index = transfer.sub_devices[i]->index;
+        int num_run = 0;
+        while (num_run < num_segments and
+               runs_before(transfer.ready_times[i * num_segments + num_run], transfer.task, entry))
+        {
+            simtime_t cost = num_run == num_segments - 1 ? transfer.costs[num_hops + i] : transfer.costs[i];
+            run.sub_device_busy_times[index] += cost;
+            run.sub_device_num_tasks[index]++;
+            transfer.run_time += cost;
+            num_run++;
+        }
+        transfer.num_run[i] = num_run;
+        if (num_run < num_segments)
+        {
+            // the device is still reserved, so the transfer was the last to use it
+            run.sub_device_times[index] =
+                num_run > 0 ? transfer.end_times[i * num_segments + num_run - 1] : transfer.device_ready_times[i];
+            run.update_sub_device(transfer.sub_devices[i]);
+            num_stepping_transfers[index]++;
+        }
+        if (reserved_transfers[index] == transfer.task)
+        {
+            reserved_transfers[index] = NO_TASK;
+        }
+    }
+    size_t hop;
+    bool ready = next_segment(transfer, hop, transfer.queued_time);
+    assert(ready);
+    ready_queue->push({transfer.queued_time, transfer.task});
+    if (profile != nullptr)
+    {
+        profile->add_count("stepped_transfers", 1);
+    }
+}
+
+bool Simulator::next_segment(MacroTransfer const &transfer, size_t &hop, simtime_t &ready_time) const
+{
+    size_t num_hops = transfer.sub_devices.size();
+    int num_segments = transfer.num_segments;
+    bool found = false;
+    for (size_t i = 0; i < num_hops; i++)
+    {
+        // the segments run in order on a device, the next one is ready when its predecessors ran
+        int j = transfer.num_run[i];
+        bool held = j > 0 and i + 1 < num_hops and transfer.holds_next[i + 1];
+        if (j == num_segments or (i > 0 and transfer.num_run[i - 1] <= j) or (held and transfer.num_run[i + 1] < j))
+        {
+            continue;
+        }
+        simtime_t segment_ready_time = i == 0 ? transfer.ready_time : transfer.end_times[(i - 1) * num_segments + j];
+        if (held)
+        {
+            segment_ready_time = max(segment_ready_time, transfer.end_times[(i + 1) * num_segments + j - 1]);
+        }
+        // on a tie, the segment on the first device has the smallest id in the segmented model
+        if (!found or segment_ready_time < ready_time)
+        {
+            found = true;
+            hop = i;
+            ready_time = segment_ready_time;
+        }
+    }
+    return found;
+}
+
+bool Simulator::step_transfer(uint32_t slot, ReadyTask const &entry)
+{
+    MacroTransfer &transfer = transfers[slot];
+    size_t num_hops = transfer.sub_devices.size();
+    int num_segments = transfer.num_segments;
+    size_t hop;
+    simtime_t ready_time;
+    bool ready = next_segment(transfer, hop, ready_time);
+    assert(ready and ready_time == entry.ready_time);
+    SubDevice *sub_device = transfer.sub_devices[hop];
+    int index = sub_device->index;
+    int j = transfer.num_run[hop];
+    claim_device(sub_device, entry);
+    simtime_t start_time = max(ready_time, run.sub_device_times[index]);
+    simtime_t cost = j == num_segments - 1 ? transfer.costs[num_hops + hop] : transfer.costs[hop];
+    if (hop == 0 and j == 0)
+    {
+        transfer.device_ready_times[0] = run.sub_device_times[index];
+        transfer.start_time = start_time;
+    }
+    run.sub_device_times[index] = start_time + cost;
+    run.sub_device_busy_times[index] += cost;
+    run.sub_device_num_tasks[index]++;
+    run.update_sub_device(sub_device);
+    transfer.run_time += cost;
+    transfer.ready_times[hop * num_segments + j] = ready_time;
+    transfer.end_times[hop * num_segments + j] = start_time + cost;
+    transfer.num_run[hop]++;
+    if (transfer.num_run[hop] == num_segments)
+    {
+        num_stepping_transfers[index]--;
+        if (hop == num_hops - 1)
+        {
+            return true;
+        }
+    }
+    ready = next_segment(transfer, hop, transfer.queued_time);
+    assert(ready);
+    ready_queue->push({transfer.queued_time, transfer.task});
+    return false;
+}
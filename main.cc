@@ -3,8 +3,20 @@
 #include <fstream>
 #include <utility>
 #include <algorithm> // std::min
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <iterator> // std::istream_iterator
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 int num_bgworks;
+int load_threads; // the threads that parse a DAG trace, 1 to parse it on the calling thread
 int default_seg_size;
 int max_num_segs;
 double realm_comm_overhead;
@@ -19,19 +31,16 @@ using std::unordered_map;
 using std::unordered_set;
 using std::vector;
 
-vector<string> split(string srcStr, const string &delim)
+vector<string> split(string const &srcStr, const string &delim)
 {
-    int nPos = 0;
     vector<string> vec;
-    nPos = srcStr.find(delim.c_str());
-    while (-1 != nPos)
+    size_t pos = 0;
+    for (size_t nPos = srcStr.find(delim); nPos != string::npos; nPos = srcStr.find(delim, pos))
     {
-        string temp = srcStr.substr(0, nPos);
-        vec.push_back(temp);
-        srcStr = srcStr.substr(nPos + 1);
-        nPos = srcStr.find(delim.c_str());
+        vec.push_back(srcStr.substr(pos, nPos - pos));
+        pos = nPos + delim.size();
     }
-    vec.push_back(srcStr);
+    vec.push_back(srcStr.substr(pos));
     return vec;
 }
 
@@ -647,344 +656,1411 @@ SimpleMachineModel *create_simple_machine_model()
     return machine;
 }
 
-void run_dag_file(Simulator &simulator, MachineModel *machine, string folder)
+// A DAG trace parsed once and kept free of the parameters that are swept: the tasks refer to
+// devices by id, and the cost of the realm tasks, their background worker and the segmentation
+// of the messages are only decided when build_dag_trace() turns the trace into a task graph.
+struct DagTask
 {
-    unordered_map<int, float> cost_map;
-    // get costs of tasks
-    std::ifstream cost_file(folder + "/cost");
-    int uid;
+    enum ProcKind
+    {
+        NO_PROC,
+        CPU_PROC,        // get_cpu(proc_id)
+        SOCKET_CPU_PROC, // get_cpu(proc_id, 0)
+        GPU_PROC,        // get_gpu(proc_id)
+        BGWORK_PROC,     // a background worker of node proc_id
+    };
+    enum MemKind
+    {
+        NO_MEM,
+        SYS_MEM,    // get_sys_mem(mem_id)
+        GPU_FB_MEM, // get_gpu_fb_mem(mem_id)
+    };
+    TaskName name;
+    string kind; // op kind, e.g. "Conv2D Forward" from the comp: line
     float cost;
-    while (cost_file >> uid >> cost)
+    bool is_main;
+    bool is_realm; // costs realm_comm_overhead
+    ProcKind proc_kind;
+    int proc_id;
+    MemKind mem_kind;
+    int mem_id;
+};
+
+struct DagDep
+{
+    int src;
+    int tar;
+    long message_size;
+};
+
+struct DagTrace
+{
+    vector<DagTask> tasks;
+    vector<DagDep> deps;
+    vector<int> start_tasks;
+    int num_comp_tasks;
+    int num_comm_tasks;
+};
+
+// A span of a mapped file, compared and parsed in place so that the loader does not allocate a
+// string for every word of a trace
+struct Token
+{
+    char const *data;
+    size_t size;
+    char const *end() const { return data + size; }
+    bool operator==(char const *text) const { return strlen(text) == size and memcmp(data, text, size) == 0; }
+    bool operator!=(char const *text) const { return !(*this == text); }
+    bool starts_with(char const *prefix) const
     {
-        // cout << uid << " " << cost << endl;
-        if (cost_map.find(uid) == cost_map.end())
+        size_t length = strlen(prefix);
+        return length <= size and memcmp(data, prefix, length) == 0;
+    }
+    // like std::string::substr
+    Token substr(size_t pos, size_t length = string::npos) const
+    {
+        assert(pos <= size);
+        return {data + pos, min(length, size - pos)};
+    }
+    string str() const { return string(data, size); }
+};
+
+// The leading integer of a token like stol(): false if it does not start with one. The end of the
+// digits is returned in end if it is given.
+bool parse_long(Token token, long &value, char const **end = nullptr)
+{
+    char const *p = token.data;
+    bool negative = p != token.end() and *p == '-';
+    if (p != token.end() and (*p == '-' or *p == '+'))
+    {
+        p++;
+    }
+    if (p == token.end() or *p < '0' or *p > '9')
+    {
+        return false;
+    }
+    long ret = 0;
+    for (; p != token.end() and *p >= '0' and *p <= '9'; p++)
+    {
+        ret = ret * 10 + (*p - '0');
+    }
+    value = negative ? -ret : ret;
+    if (end != nullptr)
+    {
+        *end = p;
+    }
+    return true;
+}
+
+// A whole token that is a number like operator>>, rounded by strtof
+bool parse_float(Token token, float &value)
+{
+    char buffer[64];
+    if (token.size == 0 or token.size >= sizeof(buffer))
+    {
+        return false;
+    }
+    memcpy(buffer, token.data, token.size);
+    buffer[token.size] = '\0';
+    char *parsed;
+    value = strtof(buffer, &parsed);
+    return parsed != buffer;
+}
+
+// The next line from pos to end without its '\n', like std::getline
+bool next_line(char const *&pos, char const *end, Token &line)
+{
+    if (pos == end)
+    {
+        return false;
+    }
+    char const *newline = (char const *)memchr(pos, '\n', end - pos);
+    char const *line_end = newline != nullptr ? newline : end;
+    line = {pos, (size_t)(line_end - pos)};
+    pos = newline != nullptr ? newline + 1 : line_end;
+    return true;
+}
+
+// A file mapped in memory, read line by line without copying. A missing file is not open and an
+// empty one has no lines, like std::ifstream.
+class MappedFile
+{
+public:
+    explicit MappedFile(string const &path) : data(nullptr), size(0), fd(open(path.c_str(), O_RDONLY))
+    {
+        struct stat st;
+        if (fd < 0 or fstat(fd, &st) != 0 or st.st_size == 0)
         {
-            cost_map[uid] = cost * 0.001; // us -> ms
+            return;
         }
-        else
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
         {
-            cout << "Has duplicate uid in cost file" << endl;
+            cout << "Cannot map " << path << endl;
+            assert(0);
         }
+        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+        data = (char const *)addr;
+        size = st.st_size;
+        pos = data;
+    }
+    ~MappedFile()
+    {
+        if (data != nullptr)
+        {
+            munmap((void *)data, size);
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+    bool is_open() const { return fd >= 0; }
+    char const *bytes() const { return data; }
+    size_t num_bytes() const { return size; }
+    bool getline(Token &line) { return data != nullptr and next_line(pos, data + size, line); }
+    // the next word between white spaces, like operator>> of a string
+    bool get_word(Token &word)
+    {
+        char const *end = data + size;
+        while (data != nullptr and pos != end and isspace((unsigned char)*pos))
+        {
+            pos++;
+        }
+        if (data == nullptr or pos == end)
+        {
+            return false;
+        }
+        word.data = pos;
+        while (pos != end and !isspace((unsigned char)*pos))
+        {
+            pos++;
+        }
+        word.size = pos - word.data;
+        return true;
     }
 
-    int num_comp_tasks = 0;
-    int num_comm_tasks = 0;
-    unordered_map<string, Task *> comp_tasks_map;
-    unordered_map<string, long> messages_map;
-    unordered_set<string> left;
-    unordered_set<string> right;
-    unordered_map<int, int> alias_map;
-    // get alias
-    std::ifstream alias_file(folder + "/alias");
-    if (alias_file.is_open())
+private:
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+    char const *data;
+    size_t size;
+    int fd;
+    char const *pos;
+};
+
+// The id of a device of the trace, the default one if it is not in the map, which stays unchanged
+template <typename T>
+T lookup_id(unordered_map<string, T> const &id_map, string const &device_id)
+{
+    auto it = id_map.find(device_id);
+    return it != id_map.end() ? it->second : T();
+}
+
+// Split a line at every ' ' like split(line, " "), empty words included, into tokens that are
+// reused from line to line
+void tokenize(Token line, vector<Token> &tokens)
+{
+    tokens.clear();
+    char const *begin = line.data;
+    for (char const *space; (space = (char const *)memchr(begin, ' ', line.end() - begin)) != nullptr; begin = space + 1)
     {
-        std::string line;
-        while (std::getline(alias_file, line))
+        tokens.push_back({begin, (size_t)(space - begin)});
+    }
+    tokens.push_back({begin, (size_t)(line.end() - begin)});
+}
+
+// The binary .simdag format of a DAG trace, written by write_simdag() from a parsed trace and
+// mapped by load_simdag() without any parsing. The file is a header, a table of sections and the
+// sections, each an array of fixed-size records starting at a multiple of 8 bytes. The tasks are
+// resolved to the ids of the devices by the id maps, so a file is only valid for a machine with
+// the same id maps: the header keeps their fingerprint. The arrays are written in the byte order
+// of the host that converts the trace.
+namespace simdag
+{
+
+const char MAGIC[8] = {'S', 'I', 'M', 'D', 'A', 'G', '\0', '\0'};
+const uint32_t VERSION = 1;
+const uint32_t NO_KIND = UINT32_MAX;
+
+enum SectionType : uint32_t
+{
+    TASKS,         // Task, the devices and the names of the tasks
+    COSTS,         // float, in ms, indexed like the tasks
+    EDGES,         // Edge, the dependencies
+    MESSAGE_SIZES, // int64_t, indexed like the edges
+    KIND_NAMES,    // char, the op kinds, each ended by '\0'
+    START_TASKS,   // uint32_t
+    NUM_SECTIONS,
+};
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_sections;
+    uint64_t id_maps_fingerprint;
+    int64_t num_comp_tasks;
+    int64_t num_comm_tasks;
+};
+
+struct Section
+{
+    uint32_t type;
+    uint32_t record_size;
+    uint64_t offset; // from the start of the file
+    uint64_t count;
+};
+
+struct Task
+{
+    int64_t name_number;
+    int32_t proc_id;
+    int32_t mem_id;
+    uint32_t kind; // the index of the op kind in KIND_NAMES, NO_KIND if it has none
+    uint8_t name_kind;
+    uint8_t proc_kind;
+    uint8_t mem_kind;
+    uint8_t flags;
+};
+
+struct Edge
+{
+    uint32_t src;
+    uint32_t tar;
+};
+
+enum TaskFlags : uint8_t
+{
+    IS_MAIN = 1,
+    IS_REALM = 2,
+};
+
+// the id maps that resolved the devices of the tasks, in a fixed order
+uint64_t id_maps_fingerprint()
+{
+    vector<pair<string, pair<int, int> > > ids(cpu_id_map.begin(), cpu_id_map.end());
+    ids.insert(ids.end(), gpu_id_map.begin(), gpu_id_map.end());
+    for (auto it = mem_id_map.begin(); it != mem_id_map.end(); ++it)
+    {
+        ids.push_back({it->first, {it->second, -1}});
+    }
+    std::sort(ids.begin(), ids.end());
+    size_t seed = ids.size();
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        boost::hash_combine(seed, ids[i].first);
+        boost::hash_combine(seed, ids[i].second.first);
+        boost::hash_combine(seed, ids[i].second.second);
+    }
+    return seed;
+}
+
+} // namespace simdag
+
+void write_simdag(DagTrace const &trace, string file)
+{
+    vector<simdag::Task> tasks(trace.tasks.size());
+    vector<float> costs(trace.tasks.size());
+    vector<simdag::Edge> edges(trace.deps.size());
+    vector<int64_t> message_sizes(trace.deps.size());
+    vector<uint32_t> start_tasks(trace.start_tasks.begin(), trace.start_tasks.end());
+    string kind_names;
+    unordered_map<string, uint32_t> kinds;
+    for (size_t i = 0; i < trace.tasks.size(); i++)
+    {
+        DagTask const &task = trace.tasks[i];
+        assert(task.name.kind == TaskName::OP_NODE or task.name.kind == TaskName::REALM_COPY or
+               task.name.kind == TaskName::REALM_FILL);
+        tasks[i].name_number = task.name.number;
+        tasks[i].proc_id = task.proc_id;
+        tasks[i].mem_id = task.mem_id;
+        tasks[i].kind = simdag::NO_KIND;
+        if (!task.kind.empty())
         {
-            vector<string> line_array = split(line, " ");
-            if (line_array[0] == "alias:")
+            auto inserted = kinds.insert(std::make_pair(task.kind, (uint32_t)kinds.size()));
+            if (inserted.second)
             {
-                int t0 = stoi(line_array[1]);
-                int t1 = stoi(line_array[2]);
-                alias_map[t0] = t1;
-                alias_map[t1] = t0;
+                kind_names.append(task.kind.c_str(), task.kind.size() + 1);
             }
+            tasks[i].kind = inserted.first->second;
         }
+        tasks[i].name_kind = task.name.kind;
+        tasks[i].proc_kind = task.proc_kind;
+        tasks[i].mem_kind = task.mem_kind;
+        tasks[i].flags = (task.is_main ? simdag::IS_MAIN : 0) | (task.is_realm ? simdag::IS_REALM : 0);
+        costs[i] = task.cost;
     }
+    for (size_t i = 0; i < trace.deps.size(); i++)
+    {
+        edges[i] = {(uint32_t)trace.deps[i].src, (uint32_t)trace.deps[i].tar};
+        message_sizes[i] = trace.deps[i].message_size;
+    }
+
+    vector<simdag::Section> sections;
+    vector<void const *> arrays;
+    uint64_t offset = sizeof(simdag::Header) + simdag::NUM_SECTIONS * sizeof(simdag::Section);
+    auto add_section = [&](simdag::SectionType type, void const *array, uint32_t record_size, size_t count) {
+        offset = (offset + 7) / 8 * 8;
+        sections.push_back({type, record_size, offset, count});
+        arrays.push_back(array);
+        offset += record_size * count;
+    };
+    add_section(simdag::TASKS, tasks.data(), sizeof(simdag::Task), tasks.size());
+    add_section(simdag::COSTS, costs.data(), sizeof(float), costs.size());
+    add_section(simdag::EDGES, edges.data(), sizeof(simdag::Edge), edges.size());
+    add_section(simdag::MESSAGE_SIZES, message_sizes.data(), sizeof(int64_t), message_sizes.size());
+    add_section(simdag::KIND_NAMES, kind_names.data(), 1, kind_names.size());
+    add_section(simdag::START_TASKS, start_tasks.data(), sizeof(uint32_t), start_tasks.size());
+    simdag::Header header = {};
+    memcpy(header.magic, simdag::MAGIC, sizeof(header.magic));
+    header.version = simdag::VERSION;
+    header.num_sections = sections.size();
+    header.id_maps_fingerprint = simdag::id_maps_fingerprint();
+    header.num_comp_tasks = trace.num_comp_tasks;
+    header.num_comm_tasks = trace.num_comm_tasks;
+
+    std::ofstream out(file, std::ios::binary);
+    out.write((char const *)&header, sizeof(header));
+    out.write((char const *)sections.data(), sections.size() * sizeof(simdag::Section));
+    for (size_t i = 0; i < sections.size(); i++)
+    {
+        static char const padding[8] = {};
+        out.write(padding, sections[i].offset - out.tellp());
+        out.write((char const *)arrays[i], sections[i].record_size * sections[i].count);
+    }
+    if (!out)
+    {
+        cout << "Cannot write " << file << endl;
+        assert(0);
+    }
+    cout << "wrote " << trace.tasks.size() << " tasks and " << trace.deps.size() << " deps to " << file << endl;
+}
+
+void load_simdag(DagTrace &trace, string file, Profile *profile = NULL)
+{
+    ProfilePhase load_phase(profile, "load_simdag");
+    MappedFile simdag_file(file);
+    char const *bytes = simdag_file.bytes();
+    size_t num_bytes = simdag_file.num_bytes();
+    simdag::Header header;
+    if (num_bytes < sizeof(header) or memcmp(bytes, simdag::MAGIC, sizeof(simdag::MAGIC)) != 0)
+    {
+        cout << file << " is not a simdag file" << endl;
+        assert(0);
+    }
+    memcpy(&header, bytes, sizeof(header));
+    if (header.version != simdag::VERSION)
+    {
+        cout << file << " has version " << header.version << ", expected " << simdag::VERSION << endl;
+        assert(0);
+    }
+    if (header.id_maps_fingerprint != simdag::id_maps_fingerprint())
+    {
+        cout << file << " was converted with the id maps of another machine" << endl;
+        assert(0);
+    }
+    // the sections, checked against the size of the file and of their records
+    static uint32_t const record_sizes[simdag::NUM_SECTIONS] = {
+        sizeof(simdag::Task), sizeof(float), sizeof(simdag::Edge), sizeof(int64_t), 1, sizeof(uint32_t)};
+    void const *arrays[simdag::NUM_SECTIONS] = {};
+    uint64_t counts[simdag::NUM_SECTIONS] = {};
+    assert(sizeof(header) + header.num_sections * sizeof(simdag::Section) <= num_bytes);
+    for (uint32_t i = 0; i < header.num_sections; i++)
+    {
+        simdag::Section section;
+        memcpy(&section, bytes + sizeof(header) + i * sizeof(section), sizeof(section));
+        if (section.type >= simdag::NUM_SECTIONS)
+        {
+            continue; // a section of a later minor change of the format
+        }
+        if (section.record_size != record_sizes[section.type] or section.offset % 8 != 0 or
+            section.offset > num_bytes or section.count > (num_bytes - section.offset) / section.record_size)
+        {
+            cout << file << " has a corrupt section " << section.type << endl;
+            assert(0);
+        }
+        arrays[section.type] = bytes + section.offset;
+        counts[section.type] = section.count;
+    }
+    simdag::Task const *tasks = (simdag::Task const *)arrays[simdag::TASKS];
+    float const *costs = (float const *)arrays[simdag::COSTS];
+    simdag::Edge const *edges = (simdag::Edge const *)arrays[simdag::EDGES];
+    int64_t const *message_sizes = (int64_t const *)arrays[simdag::MESSAGE_SIZES];
+    char const *kind_names = (char const *)arrays[simdag::KIND_NAMES];
+    uint32_t const *start_tasks = (uint32_t const *)arrays[simdag::START_TASKS];
+    size_t num_tasks = counts[simdag::TASKS];
+    size_t num_edges = counts[simdag::EDGES];
+    assert(counts[simdag::COSTS] == num_tasks and counts[simdag::MESSAGE_SIZES] == num_edges);
+
+    vector<string> kinds;
+    for (size_t i = 0; i < counts[simdag::KIND_NAMES];)
+    {
+        kinds.emplace_back(kind_names + i);
+        i += kinds.back().size() + 1;
+    }
+    trace.tasks.assign(num_tasks, DagTask());
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        simdag::Task const &record = tasks[i];
+        DagTask &task = trace.tasks[i];
+        assert(record.kind == simdag::NO_KIND or record.kind < kinds.size());
+        task.name = TaskName((TaskName::NameKind)record.name_kind, record.name_number);
+        if (record.kind != simdag::NO_KIND)
+        {
+            task.kind = kinds[record.kind];
+        }
+        task.cost = costs[i];
+        task.is_main = record.flags & simdag::IS_MAIN;
+        task.is_realm = record.flags & simdag::IS_REALM;
+        task.proc_kind = (DagTask::ProcKind)record.proc_kind;
+        task.proc_id = record.proc_id;
+        task.mem_kind = (DagTask::MemKind)record.mem_kind;
+        task.mem_id = record.mem_id;
+    }
+    trace.deps.resize(num_edges);
+    for (size_t i = 0; i < num_edges; i++)
+    {
+        assert(edges[i].src < num_tasks and edges[i].tar < num_tasks);
+        trace.deps[i] = {(int)edges[i].src, (int)edges[i].tar, (long)message_sizes[i]};
+    }
+    trace.start_tasks.assign(start_tasks, start_tasks + counts[simdag::START_TASKS]);
+    trace.num_comp_tasks = header.num_comp_tasks;
+    trace.num_comm_tasks = header.num_comm_tasks;
+    for (size_t i = 0; i < trace.start_tasks.size(); i++)
+    {
+        assert((size_t)trace.start_tasks[i] < num_tasks);
+        cout << "starts with:" << trace.tasks[trace.start_tasks[i]].name.to_string() << endl;
+    }
+}
+
+// A bounded single-producer single-consumer queue without locks: only the producer moves the
+// tail and only the consumer moves the head. A full or an empty queue is waited on by yielding.
+template <typename T, size_t CAPACITY>
+class SpscQueue
+{
+public:
+    SpscQueue() : head(0), tail(0) {}
+    void push(T const &value)
+    {
+        size_t cur_tail = tail.load(std::memory_order_relaxed);
+        while (cur_tail - head.load(std::memory_order_acquire) == CAPACITY)
+        {
+            std::this_thread::yield();
+        }
+        slots[cur_tail % CAPACITY] = value;
+        tail.store(cur_tail + 1, std::memory_order_release);
+    }
+    T pop()
+    {
+        size_t cur_head = head.load(std::memory_order_relaxed);
+        while (tail.load(std::memory_order_acquire) == cur_head)
+        {
+            std::this_thread::yield();
+        }
+        T value = slots[cur_head % CAPACITY];
+        head.store(cur_head + 1, std::memory_order_release);
+        return value;
+    }
+
+private:
+    T slots[CAPACITY];
+    std::atomic<size_t> head;
+    char padding[64]; // keeps the head and the tail on different cache lines
+    std::atomic<size_t> tail;
+};
 
-    // get comp tasks
-    std::ifstream comp_file(folder + "/comp");
-    if (comp_file.is_open())
+// the tasks, messages and dependencies parsed from a chunk of a file, and its messages to print
+struct ParsedChunk
+{
+    vector<DagTask> tasks;
+    vector<long> message_sizes; // of the realm tasks, indexed like tasks
+    vector<pair<TaskName, TaskName> > dep_names;
+    vector<DagDep> deps; // dep_names resolved to the tasks of the trace
+    string log;
+};
+
+// Parse a mapped file by chunks of whole lines into chunks, in the order of the file. Without
+// parser threads the calling thread parses the file as one chunk. Otherwise a reader thread cuts
+// the chunks, touching their pages ahead of the parsers, and deals them round robin to the
+// parsers through bounded queues.
+template <typename ParseLines>
+void parse_chunks(MappedFile const &file, int num_parsers, ParseLines parse_lines, vector<ParsedChunk> &chunks)
+{
+    static size_t const CHUNK_SIZE = 1 << 20;
+    static size_t const QUEUE_SIZE = 8;
+    static size_t const PAGE_SIZE = 4096;
+    char const *begin = file.bytes();
+    char const *end = begin + file.num_bytes();
+    if (num_parsers == 0)
     {
-        std::string line;
-        while (std::getline(comp_file, line))
+        chunks.assign(1, ParsedChunk());
+        parse_lines(begin, end, chunks[0]);
+        return;
+    }
+    struct Chunk
+    {
+        char const *begin;
+        char const *end; // nullptr ends the queue
+        size_t index;
+    };
+    // every chunk but the last one is at least CHUNK_SIZE long
+    chunks.assign(file.num_bytes() / CHUNK_SIZE + 1, ParsedChunk());
+    vector<SpscQueue<Chunk, QUEUE_SIZE> > queues(num_parsers);
+    size_t num_chunks = 0;
+    std::thread reader([&]() {
+        volatile char touched = 0;
+        for (char const *pos = begin; pos != end; num_chunks++)
         {
-            vector<string> line_array = split(line, " ");
-            /*
-            for (int i = 0; i < line_array.size(); i++) {
-                cout << line_array[i] << " ";
+            char const *chunk_end = end - pos > (ptrdiff_t)CHUNK_SIZE ? pos + CHUNK_SIZE : end;
+            char const *newline = (char const *)memchr(chunk_end - 1, '\n', end - chunk_end + 1);
+            chunk_end = newline != nullptr ? newline + 1 : end;
+            for (char const *page = pos; page < chunk_end; page += PAGE_SIZE)
+            {
+                touched = *page;
             }
-            cout << endl;
-            */
-            if (line_array[0] == "comp:")
+            queues[num_chunks % num_parsers].push({pos, chunk_end, num_chunks});
+            pos = chunk_end;
+        }
+        for (int i = 0; i < num_parsers; i++)
+        {
+            queues[i].push({nullptr, nullptr, 0});
+        }
+    });
+    vector<std::thread> parsers;
+    for (int i = 0; i < num_parsers; i++)
+    {
+        parsers.emplace_back([&, i]() {
+            for (Chunk chunk = queues[i].pop(); chunk.end != nullptr; chunk = queues[i].pop())
             {
-                num_comp_tasks++;
-                int task_id = -1;
-                bool is_main = false;
-                bool is_skip = false;
-                CompDevice *comp_device = nullptr;
-                MemDevice *mem_device = nullptr;
-                if ((line_array[1] == "Conv2D" and line_array[2] == "Forward")
-                    // or (line_array[1] == "SGD" and line_array[2] == "Parameter")
-                )
+                parse_lines(chunk.begin, chunk.end, chunks[chunk.index]);
+            }
+        });
+    }
+    reader.join();
+    for (int i = 0; i < num_parsers; i++)
+    {
+        parsers[i].join();
+    }
+    chunks.resize(num_chunks);
+}
+
+void parse_comp_lines(char const *begin, char const *end, ParsedChunk &chunk)
+{
+    Token line;
+    vector<Token> line_array;
+    string device_id; // the key of a lookup in the id maps
+    while (next_line(begin, end, line))
+    {
+        tokenize(line, line_array);
+        if (line_array[0] == "comp:")
+        {
+            long task_id = -1;
+            bool is_main = false;
+            DagTask task = {};
+            if ((line_array.size() > 2 and line_array[1] == "Conv2D" and line_array[2] == "Forward")
+                // or (line_array[1] == "SGD" and line_array[2] == "Parameter")
+            )
+            {
+                is_main = true;
+            }
+            // the words of the op kind are contiguous in the line
+            size_t kind_end = 1;
+            while (kind_end < line_array.size() and line_array[kind_end] != "(UID:")
+            {
+                kind_end++;
+            }
+            if (kind_end > 1)
+            {
+                task.kind.assign(line_array[1].data, line_array[kind_end - 1].end());
+            }
+            for (size_t i = 0; i < line_array.size(); i++)
+            {
+                if (line_array[i] == "(UID:" and i + 1 < line_array.size())
                 {
-                    is_main = true;
+                    parse_long(line_array[i + 1].substr(0, line_array[i + 1].size - 1), task_id);
                 }
-                // if ((line_array[1] == "Conv2D" and line_array[2] == "Init")
-                //     or (line_array[1] == "Load" and line_array[2] == "Entire" and line_array[3] == "Dataset")
-                //     //or (line_array[1] == "Zero" and line_array[2] == "Init")
-                //     ) {
-                //     is_skip = true;
-                // }
-                for (int i = 0; i < line_array.size(); i++)
+                if (line_array[i] == "Processor:" and i + 1 < line_array.size())
                 {
-                    // skip some init tasks
-                    if (line_array[i] == "(UID:")
+                    device_id.assign(line_array.back().data, line_array.back().size);
+                    if (line_array[i + 1] == "CPU")
                     {
-                        task_id = stoi(line_array[i + 1].substr(0, line_array[i + 1].size() - 1));
+                        pair<int, int> ids = lookup_id(cpu_id_map, device_id);
+                        task.proc_kind = DagTask::CPU_PROC;
+                        task.proc_id = ids.second;
+                        // TODO: set up mem from comm
+                        task.mem_kind = DagTask::SYS_MEM;
+                        task.mem_id = ids.first;
                     }
-                    if (line_array[i] == "Processor:")
+                    else if (line_array[i + 1] == "GPU")
                     {
-                        if (line_array[i + 1] == "CPU")
-                        {
-                            pair<int, int> ids = cpu_id_map[line_array.back()];
-                            comp_device = machine->get_cpu(ids.second);
-                            // TODO: set up mem from comm
-                            mem_device = machine->get_sys_mem(ids.first);
-                        }
-                        else if (line_array[i + 1] == "GPU")
-                        {
-                            pair<int, int> ids = gpu_id_map[line_array.back()];
-                            comp_device = machine->get_gpu(ids.second);
-                            mem_device = machine->get_gpu_fb_mem(ids.second);
-                        }
-                        else
-                        {
-                            cout << "Unknow type of processor " << line_array[i + 1] << endl;
-                        }
-                        break;
+                        pair<int, int> ids = lookup_id(gpu_id_map, device_id);
+                        task.proc_kind = DagTask::GPU_PROC;
+                        task.proc_id = ids.second;
+                        task.mem_kind = DagTask::GPU_FB_MEM;
+                        task.mem_id = ids.second;
                     }
+                    else
+                    {
+                        chunk.log += "Unknow type of processor " + line_array[i + 1].str() + "\n";
+                    }
+                    break;
+                }
+            }
+            // the cost is looked up when the tasks of all the chunks are merged
+            task.name = TaskName(TaskName::OP_NODE, task_id);
+            task.is_main = is_main;
+            chunk.tasks.push_back(task);
+            chunk.message_sizes.push_back(0);
+        }
+        else
+        {
+            chunk.log += "error\n";
+        }
+    }
+}
+
+void parse_comm_lines(char const *begin, char const *end, ParsedChunk &chunk)
+{
+    Token line;
+    vector<Token> line_array;
+    string device_id; // the key of a lookup in the id maps
+    while (next_line(begin, end, line))
+    {
+        tokenize(line, line_array);
+        if (line_array[0] == "comm:")
+        {
+            size_t loc = 2;
+            if (line_array.size() >= 7 and line_array[loc] == "'Realm" and
+                (line_array[loc + 1] == "Copy" or line_array[loc + 1] == "Fill"))
+            {
+                size_t n = line_array.size();
+                bool is_copy = line_array[loc + 1] == "Copy";
+                Token comp_device_id = line_array.back().substr(0, line_array.back().size - 3);
+                Token comp_device_type = line_array[n - 3];
+                comp_device_type = comp_device_type.substr(comp_device_type.size - 3, 3);
+                Token realm_id = line_array[loc + 2].substr(1, line_array[loc + 2].size - 2);
+                Token tar_mem_device_id = line_array[n - 4].substr(0, line_array[n - 4].size - 1);
+                Token tar_mem_device_type = line_array[n - 6];
+                long id = 0;
+                parse_long(realm_id, id);
+                DagTask task = {};
+                task.name = TaskName(is_copy ? TaskName::REALM_COPY : TaskName::REALM_FILL, id);
+                task.kind = "Realm " + line_array[loc + 1].str();
+                task.is_realm = true;
+                device_id.assign(tar_mem_device_id.data, tar_mem_device_id.size);
+                if (tar_mem_device_type == "System" or tar_mem_device_type == "Zero-Copy")
+                {
+                    int socket_id = lookup_id(mem_id_map, device_id);
+                    task.mem_kind = DagTask::SYS_MEM;
+                    task.mem_id = socket_id;
+                    // handle processor type unknown, but memory type is available
+                    task.proc_kind = DagTask::SOCKET_CPU_PROC;
+                    task.proc_id = socket_id;
                 }
-                string task_name = "op_node_" + to_string(task_id);
-                float cost = 0.0;
-                if (cost_map.find(task_id) != cost_map.end())
+                else if (tar_mem_device_type == "Framebuffer")
                 {
-                    cost = cost_map[task_id];
+                    int mem_device_id = lookup_id(mem_id_map, device_id);
+                    task.mem_kind = DagTask::GPU_FB_MEM;
+                    task.mem_id = mem_device_id;
+                    // handle processor type unknown, but memory type is available
+                    task.proc_kind = DagTask::GPU_PROC;
+                    task.proc_id = mem_device_id;
                 }
                 else
                 {
-                    cost = cost_map[alias_map[task_id]];
-                    cout << "========= task " << task_id << " has alias " << alias_map[task_id] << " with cost " << cost << endl;
+                    cout << "wrong tar_mem_device_type" << endl;
+                    assert(0);
                 }
-                if (is_skip)
+                device_id.assign(comp_device_id.data, comp_device_id.size);
+                if (comp_device_type == "CPU")
                 {
-                    cost = 0.0;
+                    pair<int, int> ids = lookup_id(cpu_id_map, device_id);
+                    task.proc_kind = DagTask::BGWORK_PROC;
+                    task.proc_id = ids.first;
                 }
-                Task *cur_task = simulator.new_comp_task(task_name, comp_device, cost, mem_device);
-                cur_task->is_main = is_main;
-                // cout << cur_task->to_string() << endl;
-                comp_tasks_map[task_name] = cur_task;
+                else if (comp_device_type == "GPU")
+                {
+                    pair<int, int> ids = lookup_id(gpu_id_map, device_id);
+                    task.proc_kind = DagTask::GPU_PROC;
+                    task.proc_id = ids.second;
+                }
+                long index_size = 0, field_size = 0;
+                for (size_t i = 0; i + 1 < n; i++)
+                {
+                    if (line_array[i] == "Index_Space_Size:")
+                    {
+                        parse_long(line_array[i + 1], index_size);
+                    }
+                    if (line_array[i] == "Field_Size:")
+                    {
+                        parse_long(line_array[i + 1], field_size);
+                        break;
+                    }
+                }
+                assert(index_size > 0 and field_size > 0);
+                chunk.tasks.push_back(task);
+                chunk.message_sizes.push_back(index_size * field_size);
             }
             else
             {
-                cout << "error" << endl;
+                cout << line.str() << endl;
+                cout << "comm: has other types" << endl;
+                assert(0);
             }
         }
-        comp_file.close();
+        else
+        {
+            chunk.log += "error\n";
+        }
     }
-    // get comm tasks
-    std::ifstream comm_file(folder + "/comm");
-    if (comm_file.is_open())
+}
+
+// the name of a task in the deps file, TaskName() if it is not the name of a task of a trace
+TaskName parse_task_name(Token name)
+{
+    TaskName::NameKind kind;
+    size_t prefix;
+    if (name.starts_with("op_node_"))
     {
-        std::string line;
-        while (std::getline(comm_file, line))
+        kind = TaskName::OP_NODE;
+        prefix = strlen("op_node_");
+    }
+    else if (name.starts_with("realm_copy_"))
+    {
+        kind = TaskName::REALM_COPY;
+        prefix = strlen("realm_copy_");
+    }
+    else if (name.starts_with("realm_fill_"))
+    {
+        kind = TaskName::REALM_FILL;
+        prefix = strlen("realm_fill_");
+    }
+    else
+    {
+        return TaskName();
+    }
+    long number;
+    char const *end;
+    if (!parse_long(name.substr(prefix), number, &end) or end != name.end())
+    {
+        return TaskName();
+    }
+    return TaskName(kind, number);
+}
+
+void parse_deps_lines(char const *begin, char const *end, ParsedChunk &chunk)
+{
+    Token line;
+    vector<Token> line_array;
+    while (next_line(begin, end, line))
+    {
+        tokenize(line, line_array);
+        if (line_array[0] == "deps:")
         {
-            vector<string> line_array = split(line, " ");
-            /*
-            for (int i = 0; i < line_array.size(); i++) {
-                cout << line_array[i] << " ";
+            if (line_array.size() > 3)
+            {
+                chunk.dep_names.push_back({parse_task_name(line_array[1]), parse_task_name(line_array[3])});
             }
-            cout << endl;
-            */
-            if (line_array[0] == "comm:")
+        }
+        else
+        {
+            chunk.log += "error\n";
+        }
+    }
+}
+
+// The loader reads the files of a trace in place from their mappings, a line is split into
+// tokens without copies and the numbers are parsed from the tokens. The comp, comm and deps
+// files are parsed at the same time by chunks, with the parser threads shared by the sizes of
+// the files, and the cost and alias files on the calling thread. The chunks are merged in the
+// order of the files, so the trace does not depend on the number of threads. The tasks of the
+// deps file are looked up by the kind and the number of their names, as soon as the tasks of the
+// comp and comm files are merged. A folder that ends with .simdag is a trace converted by
+// write_simdag().
+void load_dag_trace(DagTrace &trace, string folder, Profile *profile = NULL)
+{
+    if (folder.size() > 7 and folder.compare(folder.size() - 7, 7, ".simdag") == 0)
+    {
+        load_simdag(trace, folder, profile);
+        return;
+    }
+    ProfilePhase parse_phase(profile, "parse_dag");
+    MappedFile comp_file(folder + "/comp");
+    MappedFile comm_file(folder + "/comm");
+    MappedFile deps_file(folder + "/deps");
+    int comp_parsers = 0, comm_parsers = 0, deps_parsers = 0;
+    size_t num_bytes = comp_file.num_bytes() + comm_file.num_bytes() + deps_file.num_bytes();
+    if (load_threads > 1 and num_bytes > 0)
+    {
+        comp_parsers = std::max<int>(1, load_threads * comp_file.num_bytes() / num_bytes);
+        comm_parsers = std::max<int>(1, load_threads * comm_file.num_bytes() / num_bytes);
+        deps_parsers = std::max<int>(1, load_threads * deps_file.num_bytes() / num_bytes);
+    }
+    vector<ParsedChunk> comp_chunks, comm_chunks, deps_chunks;
+    // the tasks by the number of their names: op_node_<uid>, realm_copy_<id> and realm_fill_<id>
+    unordered_map<long, int> op_nodes;
+    unordered_map<long, int> realm_copies;
+    unordered_map<long, int> realm_fills;
+    vector<long> message_sizes; // of the realm tasks, indexed like trace.tasks
+    std::promise<void> tasks_merged;
+    std::shared_future<void> tasks_known = tasks_merged.get_future().share();
+    auto find_task = [&](TaskName name) {
+        unordered_map<long, int> const *tasks = name.kind == TaskName::OP_NODE      ? &op_nodes
+                                                : name.kind == TaskName::REALM_COPY ? &realm_copies
+                                                : name.kind == TaskName::REALM_FILL ? &realm_fills
+                                                                                    : nullptr;
+        if (tasks == nullptr)
+        {
+            return -1;
+        }
+        auto it = tasks->find(name.number);
+        return it != tasks->end() ? it->second : -1;
+    };
+    // the deps, resolved by their parsers once the tasks are known
+    auto load_deps = [&]() {
+        parse_chunks(deps_file, deps_parsers, parse_deps_lines, deps_chunks);
+        tasks_known.wait();
+        for (size_t c = 0; c < deps_chunks.size(); c++)
+        {
+            ParsedChunk &chunk = deps_chunks[c];
+            for (size_t i = 0; i < chunk.dep_names.size(); i++)
             {
-                num_comm_tasks++;
-                int loc = 2;
-                if (line_array[loc] == "'Realm" and (line_array[loc + 1] == "Copy" or line_array[loc + 1] == "Fill"))
+                TaskName const &src_name = chunk.dep_names[i].first;
+                TaskName const &tar_name = chunk.dep_names[i].second;
+                int src = find_task(src_name);
+                int tar = find_task(tar_name);
+                if (src < 0 or tar < 0)
                 {
-                    string task_name;
-                    string comp_device_id = line_array.back().substr(0, line_array.back().size() - 3);
-                    string comp_device_type = line_array[line_array.size() - 3];
-                    comp_device_type = comp_device_type.substr(comp_device_type.size() - 3, 3);
-                    string realm_id = line_array[loc + 2].substr(1, line_array[loc + 2].size() - 2);
-                    string tar_mem_device_id = "";
-                    string tar_mem_device_type = "";
-                    // cout << realm_id << endl;
-                    if (line_array[loc + 1] == "Copy")
-                    {
-                        task_name = "realm_copy_" + realm_id;
-                        tar_mem_device_id = line_array[line_array.size() - 4];
-                        tar_mem_device_id = tar_mem_device_id.substr(0, tar_mem_device_id.size() - 1);
-                        tar_mem_device_type = line_array[line_array.size() - 6];
-                    }
-                    else
-                    {
-                        task_name = "realm_fill_" + realm_id;
-                        tar_mem_device_id = line_array[line_array.size() - 4];
-                        tar_mem_device_id = tar_mem_device_id.substr(0, tar_mem_device_id.size() - 1);
-                        tar_mem_device_type = line_array[line_array.size() - 6];
-                    }
-                    // cout << task_name << " " << comp_device_type << "-" << comp_device_id << " " << tar_mem_device_type << "-" << tar_mem_device_id << endl;
-                    Task *cur_task;
-                    CompDevice *comp_device = NULL;
-                    MemDevice *mem_device = NULL;
-                    int random_bgwork_id = rand() % bgwork_ids[0].size();
-                    if (tar_mem_device_type == "System" or tar_mem_device_type == "Zero-Copy")
-                    {
-                        int socket_id = mem_id_map[tar_mem_device_id];
-                        mem_device = machine->get_sys_mem(socket_id);
-                        comp_device = machine->get_cpu(socket_id, 0); // handle processor type unknown, but memory type is available
-                    }
-                    else if (tar_mem_device_type == "Framebuffer")
-                    {
-                        int device_id = mem_id_map[tar_mem_device_id];
-                        mem_device = machine->get_gpu_fb_mem(device_id);
-                        comp_device = machine->get_gpu(device_id); // handle processor type unknown, but memory type is available
-                    }
-                    else
-                    {
-                        cout << "wrong tar_mem_device_type" << endl;
-                        assert(0);
-                    }
-                    if (comp_device_type == "CPU")
-                    {
-                        pair<int, int> ids = cpu_id_map[comp_device_id];
-                        // comp_device = machine->get_cpu(ids.second);
-                        pair<int, int> temp_ids = cpu_id_map[bgwork_ids[ids.first][random_bgwork_id]];
-                        comp_device = machine->get_cpu(temp_ids.second);
-                    }
-                    else if (comp_device_type == "GPU")
-                    {
-                        pair<int, int> ids = gpu_id_map[comp_device_id];
-                        comp_device = machine->get_gpu(ids.second);
-                    }
-                    if (comp_device == NULL)
-                    {
-                        cout << "wrong comp_device_type" << endl;
-                        assert(0);
-                    }
+                    continue;
+                }
+                long message_size = 0;
+                // realm_copy has to depend on some tasks
+                if (tar_name.kind == TaskName::REALM_COPY)
+                {
+                    message_size = message_sizes[tar];
+                }
+                else if (src_name.kind == TaskName::REALM_COPY)
+                {
+                    message_size = 0;
+                }
+                // realm_fill do not has to depend on some tasks
+                else if (tar_name.kind == TaskName::REALM_FILL)
+                {
+                    message_size = 0;
+                }
+                else if (src_name.kind == TaskName::REALM_FILL)
+                {
+                    message_size = message_sizes[src];
+                }
+                chunk.deps.push_back({src, tar, message_size});
+            }
+        }
+    };
+    vector<std::thread> file_threads;
+    if (load_threads > 1)
+    {
+        file_threads.emplace_back([&]() { parse_chunks(comp_file, comp_parsers, parse_comp_lines, comp_chunks); });
+        file_threads.emplace_back([&]() { parse_chunks(comm_file, comm_parsers, parse_comm_lines, comm_chunks); });
+        file_threads.emplace_back(load_deps);
+    }
 
-                    cur_task = simulator.new_comp_task(task_name, comp_device, machine->realm_comm_overhead, mem_device);
-                    // cout << cur_task->to_string() << endl;
-                    comp_tasks_map[task_name] = cur_task;
-                    long index_size = 0, field_size = 0;
-                    string task_uid = "";
-                    for (int i = 0; i < line_array.size(); i++)
-                    {
-                        if (line_array[i] == "Index_Space_Size:")
-                        {
-                            index_size = stol(line_array[i + 1]);
-                        }
-                        if (line_array[i] == "Field_Size:")
-                        {
-                            field_size = stol(line_array[i + 1]);
-                            break;
-                        }
-                        // Realm Fill do not have "UID:" in comm
-                        if (line_array[i] == "(UID:")
-                        {
-                            task_uid = line_array[i + 1];
-                            task_uid = task_uid.substr(0, task_uid.size() - 3);
-                        }
-                    }
-                    assert(index_size > 0 and field_size > 0);
-                    messages_map[task_name] = index_size * field_size;
-                    // cout << task_name << " - " << index_size * field_size << " bytes" << endl;
+    unordered_map<int, float> cost_map;
+    // get costs of tasks
+    MappedFile cost_file(folder + "/cost");
+    Token uid_word, cost_word;
+    long uid;
+    float cost;
+    while (cost_file.get_word(uid_word) and parse_long(uid_word, uid) and cost_file.get_word(cost_word) and
+           parse_float(cost_word, cost))
+    {
+        if (cost_map.find(uid) == cost_map.end())
+        {
+            cost_map[uid] = cost * 0.001; // us -> ms
+        }
+        else
+        {
+            cout << "Has duplicate uid in cost file" << endl;
+        }
+    }
+    unordered_map<int, int> alias_map;
+    Token line;
+    vector<Token> line_array;
+    // get alias
+    MappedFile alias_file(folder + "/alias");
+    while (alias_file.getline(line))
+    {
+        tokenize(line, line_array);
+        long t0, t1;
+        if (line_array[0] == "alias:" and line_array.size() >= 3 and parse_long(line_array[1], t0) and
+            parse_long(line_array[2], t1))
+        {
+            alias_map[t0] = t1;
+            alias_map[t1] = t0;
+        }
+    }
+
+    // merge the comp and comm tasks
+    if (load_threads > 1)
+    {
+        file_threads[0].join();
+        file_threads[1].join();
+    }
+    else
+    {
+        parse_chunks(comp_file, 0, parse_comp_lines, comp_chunks);
+        parse_chunks(comm_file, 0, parse_comm_lines, comm_chunks);
+    }
+    trace.tasks.clear();
+    trace.deps.clear();
+    trace.start_tasks.clear();
+    trace.num_comp_tasks = 0;
+    trace.num_comm_tasks = 0;
+    size_t num_tasks = 0;
+    for (size_t c = 0; c < comp_chunks.size() + comm_chunks.size(); c++)
+    {
+        num_tasks += (c < comp_chunks.size() ? comp_chunks[c] : comm_chunks[c - comp_chunks.size()]).tasks.size();
+    }
+    trace.tasks.reserve(num_tasks);
+    message_sizes.reserve(num_tasks);
+    for (size_t c = 0; c < comp_chunks.size() + comm_chunks.size(); c++)
+    {
+        bool is_comp = c < comp_chunks.size();
+        ParsedChunk &chunk = is_comp ? comp_chunks[c] : comm_chunks[c - comp_chunks.size()];
+        cout << chunk.log;
+        (is_comp ? trace.num_comp_tasks : trace.num_comm_tasks) += chunk.tasks.size();
+        for (size_t i = 0; i < chunk.tasks.size(); i++)
+        {
+            DagTask &task = chunk.tasks[i];
+            long task_id = task.name.number;
+            if (is_comp and cost_map.find(task_id) != cost_map.end())
+            {
+                task.cost = cost_map[task_id];
+            }
+            else if (is_comp)
+            {
+                task.cost = cost_map[alias_map[task_id]];
+                cout << "========= task " << task_id << " has alias " << alias_map[task_id] << " with cost " << task.cost << endl;
+            }
+            unordered_map<long, int> &tasks = task.name.kind == TaskName::OP_NODE      ? op_nodes
+                                              : task.name.kind == TaskName::REALM_COPY ? realm_copies
+                                                                                       : realm_fills;
+            tasks[task_id] = trace.tasks.size();
+            trace.tasks.push_back(std::move(task));
+            message_sizes.push_back(chunk.message_sizes[i]);
+        }
+    }
+    comp_chunks.clear();
+    comm_chunks.clear();
+    tasks_merged.set_value();
+
+    // merge the deps
+    if (load_threads > 1)
+    {
+        file_threads[2].join();
+    }
+    else
+    {
+        load_deps();
+    }
+    size_t num_deps = 0;
+    for (size_t c = 0; c < deps_chunks.size(); c++)
+    {
+        num_deps += deps_chunks[c].deps.size();
+    }
+    trace.deps.reserve(num_deps);
+    vector<bool> left(trace.tasks.size(), false);
+    vector<bool> right(trace.tasks.size(), false);
+    for (size_t c = 0; c < deps_chunks.size(); c++)
+    {
+        cout << deps_chunks[c].log;
+        for (size_t i = 0; i < deps_chunks[c].deps.size(); i++)
+        {
+            DagDep const &dep = deps_chunks[c].deps[i];
+            trace.deps.push_back(dep);
+            left[dep.src] = true;
+            right[dep.tar] = true;
+        }
+    }
+
+    for (size_t i = 0; i < trace.tasks.size(); i++)
+    {
+        if (left[i] and !right[i])
+        {
+            cout << "starts with:" << trace.tasks[i].name.to_string() << endl;
+            trace.start_tasks.push_back(i);
+        }
+    }
+}
+
+// Build the task graph of a trace on the machine of the simulator. The id maps are only read
+// here, so several threads can build the same trace for different machines at once.
+void build_dag_trace(Simulator &simulator, DagTrace const &trace, int num_bgworks)
+{
+    MachineModel *machine = simulator.machine;
+    ProfilePhase comp_phase(simulator.get_profile(), "build_comp_tasks");
+    vector<Task *> tasks(trace.tasks.size());
+    for (size_t i = 0; i < trace.tasks.size(); i++)
+    {
+        DagTask const &task = trace.tasks[i];
+        CompDevice *comp_device = nullptr;
+        MemDevice *mem_device = nullptr;
+        if (task.proc_kind == DagTask::CPU_PROC)
+        {
+            comp_device = machine->get_cpu(task.proc_id);
+        }
+        else if (task.proc_kind == DagTask::SOCKET_CPU_PROC)
+        {
+            comp_device = machine->get_cpu(task.proc_id, 0);
+        }
+        else if (task.proc_kind == DagTask::GPU_PROC)
+        {
+            comp_device = machine->get_gpu(task.proc_id);
+        }
+        else if (task.proc_kind == DagTask::BGWORK_PROC)
+        {
+            std::string bgwork_id = bgwork_ids[task.proc_id][simulator.get_rng()() % num_bgworks];
+            auto it = cpu_id_map.find(bgwork_id);
+            comp_device = machine->get_cpu(it != cpu_id_map.end() ? it->second.second : 0);
+        }
+        if (task.mem_kind == DagTask::SYS_MEM)
+        {
+            mem_device = machine->get_sys_mem(task.mem_id);
+        }
+        else if (task.mem_kind == DagTask::GPU_FB_MEM)
+        {
+            mem_device = machine->get_gpu_fb_mem(task.mem_id);
+        }
+        if (task.is_realm)
+        {
+            if (comp_device == NULL)
+            {
+                cout << "wrong comp_device_type" << endl;
+                assert(0);
+            }
+            tasks[i] = simulator.new_comp_task(task.name, comp_device, machine->realm_comm_overhead, mem_device);
+        }
+        else
+        {
+            tasks[i] = simulator.new_comp_task(task.name, comp_device, task.cost, mem_device);
+            tasks[i]->is_main = task.is_main;
+        }
+        tasks[i]->kind = task.kind.empty() ? nullptr : simulator.intern(task.kind);
+    }
+    comp_phase.stop();
+    // segments of the messages and their dependencies
+    ProfilePhase comm_phase(simulator.get_profile(), "build_comm_tasks");
+    for (size_t i = 0; i < trace.deps.size(); i++)
+    {
+        simulator.new_comm_task(tasks[trace.deps[i].src], tasks[trace.deps[i].tar], trace.deps[i].message_size);
+    }
+    comm_phase.stop();
+    for (size_t i = 0; i < trace.start_tasks.size(); i++)
+    {
+        simulator.enter_ready_queue(tasks[trace.start_tasks[i]]);
+    }
+}
+
+void run_dag_file(Simulator &simulator, string folder)
+{
+    DagTrace trace;
+    load_dag_trace(trace, folder, simulator.get_profile());
+    build_dag_trace(simulator, trace, num_bgworks);
+    simulator.simulate();
+    cout << "num_comp_tasks " << trace.num_comp_tasks << endl;
+    cout << "num_comm_tasks " << trace.num_comm_tasks << endl;
+}
+
+// One parameter set of a sweep, and the results of simulating it
+struct SweepConfig
+{
+    string name;
+    int num_bgworks;
+    int default_seg_size;
+    int max_num_segs;
+    double realm_comm_overhead;
+    unordered_map<string, string> machine_overrides; // keys of the machine config file
+    float sim_time;
+    float total_comp_time;
+    float total_comm_time;
+    int total_simulated_comp_tasks;
+};
+
+// Read the parameter sets of a sweep. Every line lists key=value words, where the keys are
+// num_bgworks, default_seg_size, max_num_segs, realm_comm_overhead or a key of the machine config
+// file, e.g. "default_seg_size=1048576 nic_bandwidth=12.5". A comma separated list of values
+// makes a grid: the line expands to the cross product of all its lists. Parameters that are not
+// given keep the values of the command line.
+void load_sweep_configs(string file, vector<SweepConfig> &configs)
+{
+    std::ifstream sweep_file(file);
+    if (!sweep_file.is_open())
+    {
+        cout << "Cannot open sweep file " << file << endl;
+        assert(0);
+    }
+    std::string line;
+    while (std::getline(sweep_file, line))
+    {
+        std::istringstream iss(line);
+        vector<string> words{std::istream_iterator<string>{iss}, std::istream_iterator<string>{}};
+        if (words.empty() or words[0][0] == '#')
+        {
+            continue;
+        }
+        vector<string> keys;
+        vector<vector<string> > values;
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            size_t pos = words[i].find('=');
+            if (pos == string::npos)
+            {
+                cout << "sweep: expected key=value instead of " << words[i] << endl;
+                assert(0);
+            }
+            keys.push_back(words[i].substr(0, pos));
+            values.push_back(split(words[i].substr(pos + 1), ","));
+        }
+        // walk the grid like an odometer, the last key changes fastest
+        vector<size_t> pos(keys.size(), 0);
+        while (true)
+        {
+            SweepConfig config = {};
+            config.num_bgworks = num_bgworks;
+            config.default_seg_size = default_seg_size;
+            config.max_num_segs = max_num_segs;
+            config.realm_comm_overhead = realm_comm_overhead;
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                string const &value = values[i][pos[i]];
+                if (keys[i] == "num_bgworks")
+                {
+                    config.num_bgworks = stoi(value);
+                }
+                else if (keys[i] == "default_seg_size")
+                {
+                    config.default_seg_size = stoi(value);
+                }
+                else if (keys[i] == "max_num_segs")
+                {
+                    config.max_num_segs = stoi(value);
+                }
+                else if (keys[i] == "realm_comm_overhead")
+                {
+                    config.realm_comm_overhead = stod(value);
                 }
                 else
                 {
-                    cout << line << endl;
-                    cout << "comm: has other types" << endl;
-                    assert(0);
+                    config.machine_overrides[keys[i]] = value;
                 }
+                config.name += (i > 0 ? " " : "") + keys[i] + "=" + value;
             }
-            else
+            configs.push_back(config);
+            size_t i = keys.size();
+            while (i > 0 and ++pos[i - 1] == values[i - 1].size())
+            {
+                pos[--i] = 0;
+            }
+            if (i == 0)
             {
-                cout << "error" << endl;
+                break;
             }
         }
-        comp_file.close();
     }
-    // get deps
-    std::ifstream deps_file(folder + "/deps");
-    if (deps_file.is_open())
+}
+
+// Simulate every parameter set of a sweep with num_workers threads and print one row per set.
+// The trace is parsed once and shared by the workers, but every parameter set gets its own
+// machine model and task graph since the segmentation of the messages depends on both. All the
+// machine models need the layout of the given one, which the id maps were set up for. Every
+// parameter set is simulated with the same seed.
+void run_sweep(vector<SweepConfig> &configs, MachineModel *machine, string model_config, string folder,
+               ReadyQueue::QueueType queue_type, int num_workers, uint64_t seed, Profile *profile)
+{
+    DagTrace trace;
+    load_dag_trace(trace, folder, profile);
+    // the simulators of the sweep run in parallel, only the whole sweep is timed
+    ProfilePhase sweep_phase(profile, "sweep");
+    vector<MachineModel *> machines;
+    for (size_t i = 0; i < configs.size(); i++)
     {
-        std::string line;
-        while (std::getline(deps_file, line))
+        MachineModel *config_machine = NULL;
+        if (machine->get_version() == 0)
         {
-            vector<string> line_array = split(line, " ");
-            /*
-            for (int i = 0; i < line_array.size(); i++) {
-                cout << line_array[i] << " ";
-            }
-            cout << endl;
-            */
-            if (line_array[0] == "deps:")
+            if (!configs[i].machine_overrides.empty())
             {
-                // cout << line << endl;
-                // cout << line_array[1] << " " << line_array[3] << endl;
-                if (comp_tasks_map.find(line_array[1]) != comp_tasks_map.end() and
-                    comp_tasks_map.find(line_array[3]) != comp_tasks_map.end())
-                {
-                    long message_size = 0;
-                    // realm_copy has to depend on some tasks
-                    if (starts_with(line_array[3], "realm_copy"))
-                    {
-                        message_size = messages_map[line_array[3]];
-                    }
-                    else if (starts_with(line_array[1], "realm_copy"))
-                    {
-                        message_size = 0;
-                    }
-                    // realm_fill do not has to depend on some tasks
-                    else if (starts_with(line_array[3], "realm_fill"))
-                    {
-                        message_size = 0;
-                    }
-                    else if (starts_with(line_array[1], "realm_fill"))
-                    {
-                        message_size = messages_map[line_array[1]];
-                    }
-                    simulator.new_comm_task(comp_tasks_map[line_array[1]], comp_tasks_map[line_array[3]], message_size);
-                    if (left.find(line_array[1]) == left.end())
-                    {
-                        left.insert(line_array[1]);
-                    }
-                    if (right.find(line_array[3]) == right.end())
-                    {
-                        right.insert(line_array[3]);
-                    }
-                }
-                else
-                {
-                    if (comp_tasks_map.find(line_array[1]) == comp_tasks_map.end())
-                        // cout << "deps: cannot find " << line_array[1] << endl;
-                        ;
-                    if (comp_tasks_map.find(line_array[3]) == comp_tasks_map.end())
-                        // cout << "deps: cannot find " << line_array[3] << endl;
-                        ;
-                }
+                cout << "sweep: the simple machine model has no config file to override" << endl;
+                assert(0);
             }
-            else
+            config_machine = new SimpleMachineModel(2, 44, 6);
+        }
+        else
+        {
+            config_machine = new EnhancedMachineModel(model_config, configs[i].machine_overrides);
+        }
+        if (config_machine->get_num_nodes() != machine->get_num_nodes() or
+            config_machine->get_num_sockets_per_node() != machine->get_num_sockets_per_node() or
+            config_machine->get_num_cpus_per_socket() != machine->get_num_cpus_per_socket() or
+            config_machine->get_num_gpus_per_socket() != machine->get_num_gpus_per_socket())
+        {
+            cout << "sweep: " << configs[i].name << " changes the layout of the machine" << endl;
+            assert(0);
+        }
+        if (configs[i].num_bgworks < 1 or configs[i].num_bgworks > bgwork_ids[0].size())
+        {
+            cout << "sweep: " << configs[i].name << " needs 1 to " << bgwork_ids[0].size() << " bgworks" << endl;
+            assert(0);
+        }
+        config_machine->default_seg_size = configs[i].default_seg_size;
+        config_machine->max_num_segs = configs[i].max_num_segs;
+        config_machine->realm_comm_overhead = configs[i].realm_comm_overhead;
+        machines.push_back(config_machine);
+    }
+
+    std::atomic<size_t> next_config(0);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    vector<std::thread> workers;
+    for (int w = 0; w < num_workers; w++)
+    {
+        workers.emplace_back([&]() {
+            size_t i;
+            while ((i = next_config++) < configs.size())
             {
-                cout << "error" << endl;
+                Simulator simulator(machines[i], queue_type);
+                simulator.set_print_summary(false);
+                simulator.set_seed(seed);
+                build_dag_trace(simulator, trace, configs[i].num_bgworks);
+                simulator.simulate();
+                configs[i].sim_time = to_ms(simulator.sim_time);
+                configs[i].total_comp_time = to_ms(simulator.total_comp_time);
+                configs[i].total_comm_time = to_ms(simulator.total_comm_time);
+                configs[i].total_simulated_comp_tasks = simulator.total_simulated_comp_tasks;
             }
-        }
-        deps_file.close();
+        });
+    }
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        workers[w].join();
+    }
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double> >(stop - start);
+
+    for (size_t i = 0; i < configs.size(); i++)
+    {
+        cout << "sweep " << i << " " << configs[i].name << " sim_time " << configs[i].sim_time << "ms total_comp_time "
+             << configs[i].total_comp_time << "ms total_comm_time " << configs[i].total_comm_time
+             << "ms total_simulated_comp_tasks " << configs[i].total_simulated_comp_tasks << endl;
+        delete machines[i];
     }
+    cout << "sweep: " << configs.size() << " configs with " << num_workers << " threads in " << time_span.count()
+         << " seconds" << endl;
+}
+
+// Print a statistic of an ensemble and its 95% confidence interval
+void print_ensemble_stat(string name, double value, double low, double high)
+{
+    cout << "ensemble sim_time " << name << " " << value << "ms ci95 [" << low << "ms, " << high << "ms]" << endl;
+}
+
+// The q-quantile of sorted samples. Its confidence interval is distribution-free: the number of
+// samples below the true quantile is binomial, and the bounds are the samples at the ranks of
+// the normal approximation of the binomial.
+void print_ensemble_quantile(string name, vector<double> const &samples, double q)
+{
+    double n = samples.size();
+    double spread = 1.96 * std::sqrt(n * q * (1 - q));
+    auto at_rank = [&](double rank) {
+        return samples[std::min(std::max(rank, 1.0), n) - 1];
+    };
+    print_ensemble_stat(name, at_rank(std::ceil(n * q)), at_rank(std::floor(n * q - spread)),
+                        at_rank(std::ceil(n * q + spread)));
+}
 
-    for (auto i : left)
+// Simulate a trace with the seeds first_seed to first_seed + num_seeds - 1 with num_workers
+// threads, and print the mean and the tail percentiles of sim_time over the seeds. The random
+// choices of a run, the background workers of the realm tasks, only depend on its seed, so any
+// run of the ensemble is reproduced by a single run with its seed. Every worker has its own
+// machine model, with the layout of the given one.
+void run_ensemble(int num_seeds, uint64_t first_seed, MachineModel *machine, string model_config, string folder,
+                  ReadyQueue::QueueType queue_type, int num_workers, Profile *profile)
+{
+    DagTrace trace;
+    load_dag_trace(trace, folder, profile);
+    ProfilePhase ensemble_phase(profile, "ensemble");
+    num_workers = std::max(1, std::min(num_workers, num_seeds));
+    vector<MachineModel *> machines;
+    for (int w = 0; w < num_workers; w++)
     {
-        if (right.find(i) == right.end())
+        MachineModel *worker_machine = NULL;
+        if (machine->get_version() == 0)
+        {
+            worker_machine = new SimpleMachineModel(2, 44, 6);
+        }
+        else
         {
-            cout << "starts with:" << i << endl;
-            simulator.enter_ready_queue(comp_tasks_map[i]);
+            worker_machine = new EnhancedMachineModel(model_config);
         }
+        worker_machine->default_seg_size = machine->default_seg_size;
+        worker_machine->max_num_segs = machine->max_num_segs;
+        worker_machine->realm_comm_overhead = machine->realm_comm_overhead;
+        machines.push_back(worker_machine);
     }
 
-    simulator.simulate();
-    cout << "num_comp_tasks " << num_comp_tasks << endl;
-    cout << "num_comm_tasks " << num_comm_tasks << endl;
+    vector<double> sim_times(num_seeds);
+    std::atomic<int> next_seed(0);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    vector<std::thread> workers;
+    for (int w = 0; w < num_workers; w++)
+    {
+        workers.emplace_back([&, w]() {
+            Simulator simulator(machines[w], queue_type);
+            simulator.set_print_summary(false);
+            int i;
+            while ((i = next_seed++) < num_seeds)
+            {
+                simulator.reset();
+                simulator.set_seed(first_seed + i);
+                machines[w]->restart_round_robin();
+                build_dag_trace(simulator, trace, num_bgworks);
+                simulator.simulate();
+                sim_times[i] = to_ms(simulator.sim_time);
+            }
+        });
+    }
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        workers[w].join();
+    }
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double> >(stop - start);
+    for (size_t w = 0; w < machines.size(); w++)
+    {
+        delete machines[w];
+    }
+
+    size_t worst = std::max_element(sim_times.begin(), sim_times.end()) - sim_times.begin();
+    vector<double> samples = sim_times;
+    std::sort(samples.begin(), samples.end());
+    double n = num_seeds;
+    double mean = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        mean += samples[i] / n;
+    }
+    double variance = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        variance += (samples[i] - mean) * (samples[i] - mean) / std::max(n - 1, 1.0);
+    }
+    double error = 1.96 * std::sqrt(variance / n);
+    cout << "ensemble: " << num_seeds << " seeds from " << first_seed << " with " << num_workers << " threads in "
+         << time_span.count() << " seconds" << endl;
+    print_ensemble_stat("mean", mean, mean - error, mean + error);
+    print_ensemble_quantile("p50", samples, 0.5);
+    print_ensemble_quantile("p95", samples, 0.95);
+    print_ensemble_quantile("p99", samples, 0.99);
+    cout << "ensemble sim_time min " << samples.front() << "ms max " << samples.back() << "ms with seed "
+         << first_seed + worst << endl;
 }
 
 // max_peer: the number of concurrent communications
@@ -1096,9 +2172,167 @@ void test_congestion(Simulator &simulator, MachineModel *machine, size_t message
     simulator.simulate();
 }
 
+// a collective among all the GPUs of the machine: "ring", "tree" and "halving_doubling"
+// allreduces, "auto" for the allreduce with the shortest estimate, or "all_to_all"
+void test_collective(Simulator &simulator, MachineModel *machine, size_t message_size, string collective)
+{
+    vector<Task *> src_tasks;
+    vector<Task *> tar_tasks;
+    for (int i = 0; i < machine->get_num_gpus(); i++)
+    {
+        string rank = " rank " + to_string(i);
+        src_tasks.push_back(simulator.new_comp_task("start" + rank, machine->get_gpu(i), 0, machine->get_gpu_fb_mem(i)));
+        tar_tasks.push_back(simulator.new_comp_task("end" + rank, machine->get_gpu(i), 0, machine->get_gpu_fb_mem(i)));
+        simulator.enter_ready_queue(src_tasks.back());
+    }
+    if (collective == "all_to_all")
+    {
+        simulator.new_all_to_all(src_tasks, tar_tasks, message_size);
+    }
+    else
+    {
+        vector<string> names = {"auto", "ring", "tree", "halving_doubling"};
+        size_t algorithm = std::find(names.begin(), names.end(), collective) - names.begin();
+        if (algorithm == names.size())
+        {
+            cout << "Unknown collective " << collective << endl;
+            assert(0);
+        }
+        for (size_t i = 1; i < names.size(); i++)
+        {
+            cout << "estimate " << names[i] << " allreduce "
+                 << simulator.estimate_allreduce(src_tasks, message_size, (Simulator::CollectiveAlgorithm)i) << "ms" << endl;
+        }
+        algorithm = simulator.new_allreduce(src_tasks, tar_tasks, message_size, (Simulator::CollectiveAlgorithm)algorithm);
+        cout << "collective " << names[algorithm] << " allreduce of " << message_size << " bytes on "
+             << src_tasks.size() << " gpus" << endl;
+    }
+    simulator.simulate();
+}
+
+// Hold-model benchmark of the ready queues: keep num_tasks tasks in the queue, then repeatedly pop
+// the earliest one and push a new one that becomes ready an exponentially distributed time later.
+// Every queue has to pop the tasks in the same order, which is checked with a checksum of the ids.
+void bench_ready_queue(size_t num_tasks, size_t num_holds)
+{
+    vector<pair<string, ReadyQueue::QueueType> > queue_types;
+    queue_types.push_back({"heap", ReadyQueue::HEAP_QUEUE});
+    queue_types.push_back({"calendar", ReadyQueue::CALENDAR_QUEUE});
+    queue_types.push_back({"radix", ReadyQueue::RADIX_QUEUE});
+    for (size_t i = 0; i < queue_types.size(); i++)
+    {
+        ReadyQueue *queue = ReadyQueue::create(queue_types[i].second);
+        std::mt19937 gen(0);
+        std::exponential_distribution<float> dist(1.0f);
+        task_id_t id = 0;
+        for (size_t j = 0; j < num_tasks; j++)
+        {
+            queue->push({to_simtime(dist(gen)), id++});
+        }
+        size_t checksum = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t j = 0; j < num_holds; j++)
+        {
+            ReadyTask task = queue->pop();
+            checksum = checksum * 31 + task.id;
+            queue->push({task.ready_time + to_simtime(dist(gen)), id++});
+        }
+        while (!queue->empty())
+        {
+            checksum = checksum * 31 + queue->pop().id;
+        }
+        std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+        std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double> >(stop - start);
+        cout << "bench_ready_queue " << queue_types[i].first << ": " << num_tasks << " tasks, " << num_holds << " holds, "
+             << time_span.count() << " seconds, checksum " << checksum << endl;
+        delete queue;
+    }
+}
+
+// Scaling benchmark of a parallel engine: simulate the task graph that was built last with
+// 1, 2, 4, ... max_threads threads and check that every run reproduces the sequential result.
+void bench_threads(Simulator &simulator, Simulator::Engine engine, int max_threads)
+{
+    simulator.set_trace_sink(NULL);
+    double sequential_time = 0.0;
+    simtime_t sim_time = 0;
+    simtime_t comp_time = 0;
+    simtime_t comm_time = 0;
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+    {
+        simulator.set_engine(num_threads == 1 ? Simulator::SEQUENTIAL_ENGINE : engine, num_threads);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        simulator.simulate();
+        std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+        std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double> >(stop - start);
+        if (num_threads == 1)
+        {
+            sequential_time = time_span.count();
+            sim_time = simulator.sim_time;
+            comp_time = simulator.total_comp_time;
+            comm_time = simulator.total_comm_time;
+        }
+        bool same = simulator.sim_time == sim_time and simulator.total_comp_time == comp_time and
+                    simulator.total_comm_time == comm_time;
+        cout << "bench_threads " << num_threads << ": " << time_span.count() << " seconds, speedup "
+             << sequential_time / time_span.count() << (same ? "" : ", RESULT DIFFERS") << endl;
+    }
+}
+
+// Benchmark of incremental re-simulation: scale the run times of random comp tasks of the task
+// graph that was built last, one task at a time, and re-simulate after every edit. The result of
+// the last edit is checked against a full simulation with all the edits.
+void bench_incremental(Simulator &simulator, size_t num_edits)
+{
+    simulator.set_trace_sink(NULL);
+    simulator.set_print_summary(false);
+    simulator.set_engine(Simulator::SEQUENTIAL_ENGINE);
+    simulator.set_incremental(true);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    simulator.simulate();
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    double full_time = std::chrono::duration_cast<std::chrono::duration<double> >(stop - start).count();
+
+    TaskGraph &graph = simulator.graph;
+    vector<simtime_t> costs = graph.costs;
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> scale(0.5f, 1.5f);
+    size_t num_replayed = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_edits; i++)
+    {
+        task_id_t task = gen() % graph.num_tasks();
+        while (graph.devices[task]->type != Device::DEVICE_COMP)
+        {
+            task = gen() % graph.num_tasks();
+        }
+        float run_time = to_ms(costs[task]) * scale(gen);
+        graph.costs[task] = to_simtime(run_time);
+        simulator.set_run_time(graph.tasks[task], run_time);
+        simulator.resimulate();
+        num_replayed += simulator.schedule.replay_order.size();
+    }
+    stop = std::chrono::steady_clock::now();
+    double incremental_time = std::chrono::duration_cast<std::chrono::duration<double> >(stop - start).count();
+    simtime_t sim_time = simulator.sim_time;
+
+    // the graph carries the edits for the full simulation, then gets its costs back
+    simulator.simulate();
+    bool same = simulator.sim_time == sim_time;
+    graph.costs = costs;
+    simulator.set_incremental(false);
+    simulator.set_print_summary(true);
+    cout << "bench_incremental: " << num_edits << " edits in " << incremental_time << " seconds, "
+         << incremental_time / num_edits * 1e6 << " us per edit, full simulation " << full_time * 1e6
+         << " us, speedup " << full_time * num_edits / incremental_time << ", replayed "
+         << 100.0 * num_replayed / num_edits / graph.num_tasks() << "% of the tasks" << (same ? "" : ", RESULT DIFFERS")
+         << endl;
+}
+
 int main(int argc, char **argv)
 {
     num_bgworks = 1;
+    load_threads = std::max(1u, std::thread::hardware_concurrency());
     default_seg_size = 4194304;
     max_num_segs = 10;
     realm_comm_overhead = 0.1;
@@ -1111,6 +2345,29 @@ int main(int argc, char **argv)
     int if_run_dag_file = 0;
     int if_test_comm = 0;
     int if_test_congestion = 0;
+    string collective = "";
+    size_t bench_queue_size = 0;
+    string trace = "none";
+    string trace_file = "";
+    string critical_path_file = ""; // "-" for stdout
+    string memory_report_file = ""; // "-" for stdout
+    int if_memory_check = 0;        // exit with an error if a memory is over its capacity
+    string profile_file = "";       // JSON profile of the run, "-" for stdout
+    int if_device_stats = 0;
+    ReadyQueue::QueueType queue_type = ReadyQueue::HEAP_QUEUE;
+    Simulator::Engine engine = Simulator::SEQUENTIAL_ENGINE;
+    int num_threads = 1;
+    int bench_max_threads = 0;
+    size_t bench_edits = 0;
+    string sweep_file = "";
+    string simdag_file = ""; // the log folder converted to the binary .simdag format
+    double fold_tolerance = 0; // iteration folding is off by default
+    int if_flow_model = 0;
+    int if_macro_transfers = 0;
+    int sweep_threads = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t seed = 0;
+    int ensemble_seeds = 0;
+    int ensemble_threads = sweep_threads;
     for (int i = 1; i < argc; i++)
     {
         std::string arg = argv[i];
@@ -1150,6 +2407,10 @@ int main(int argc, char **argv)
         {
             realm_comm_overhead = atof(argv[++i]);
         }
+        if (arg == "--write_simdag")
+        {
+            simdag_file = argv[++i];
+        }
         if (arg == "--if_run_dag_file" or arg == "-dag")
         {
             if_run_dag_file = atoi(argv[++i]);
@@ -1162,6 +2423,132 @@ int main(int argc, char **argv)
         {
             if_test_congestion = atoi(argv[++i]);
         }
+        if (arg == "--collective" or arg == "-coll")
+        {
+            collective = argv[++i];
+        }
+        if (arg == "--ready_queue" or arg == "-q")
+        {
+            string queue = argv[++i];
+            if (queue == "heap")
+            {
+                queue_type = ReadyQueue::HEAP_QUEUE;
+            }
+            else if (queue == "calendar")
+            {
+                queue_type = ReadyQueue::CALENDAR_QUEUE;
+            }
+            else if (queue == "radix")
+            {
+                queue_type = ReadyQueue::RADIX_QUEUE;
+            }
+            else
+            {
+                cout << "Unknown ready queue " << queue << endl;
+                assert(0);
+            }
+        }
+        if (arg == "--engine" or arg == "-e")
+        {
+            string name = argv[++i];
+            if (name == "sequential")
+            {
+                engine = Simulator::SEQUENTIAL_ENGINE;
+            }
+            else if (name == "conservative")
+            {
+                engine = Simulator::CONSERVATIVE_ENGINE;
+            }
+            else if (name == "optimistic")
+            {
+                engine = Simulator::OPTIMISTIC_ENGINE;
+            }
+            else
+            {
+                cout << "Unknown engine " << name << endl;
+                assert(0);
+            }
+        }
+        if (arg == "--threads" or arg == "-j")
+        {
+            num_threads = atoi(argv[++i]);
+        }
+        if (arg == "--bench_threads" or arg == "-bt")
+        {
+            bench_max_threads = atoi(argv[++i]);
+        }
+        if (arg == "--sweep")
+        {
+            sweep_file = argv[++i];
+        }
+        if (arg == "--load_threads")
+        {
+            load_threads = std::max(1, atoi(argv[++i]));
+        }
+        if (arg == "--sweep_threads")
+        {
+            sweep_threads = atoi(argv[++i]);
+        }
+        if (arg == "--seed")
+        {
+            seed = std::stoull(argv[++i]);
+        }
+        if (arg == "--ensemble")
+        {
+            ensemble_seeds = atoi(argv[++i]);
+        }
+        if (arg == "--ensemble_threads")
+        {
+            ensemble_threads = atoi(argv[++i]);
+        }
+        if (arg == "--bench_incremental" or arg == "-bi")
+        {
+            bench_edits = atol(argv[++i]);
+        }
+        if (arg == "--flow_model" or arg == "-flow")
+        {
+            if_flow_model = atoi(argv[++i]);
+        }
+        if (arg == "--macro_transfers" or arg == "-macro")
+        {
+            if_macro_transfers = atoi(argv[++i]);
+        }
+        if (arg == "--fold_iterations" or arg == "-fold")
+        {
+            fold_tolerance = atof(argv[++i]);
+        }
+        if (arg == "--trace" or arg == "-t")
+        {
+            trace = argv[++i];
+        }
+        if (arg == "--trace_file")
+        {
+            trace_file = argv[++i];
+        }
+        if (arg == "--critical_path" or arg == "-cp")
+        {
+            critical_path_file = argv[++i];
+        }
+        if (arg == "--memory_report" or arg == "-mem")
+        {
+            memory_report_file = argv[++i];
+        }
+        if (arg == "--memory_check")
+        {
+            if_memory_check = atoi(argv[++i]);
+        }
+        if (arg == "--profile")
+        {
+            profile_file = argv[++i];
+        }
+        if (arg == "--device_stats" or arg == "-ds")
+        {
+            if_device_stats = atoi(argv[++i]);
+        }
+        if (arg == "--bench_ready_queue" or arg == "-bq")
+        {
+            bench_queue_size = atol(argv[++i]);
+        }
     }
     cout << "num_bgworks = " << num_bgworks << endl;
     cout << "default_seg_size = " << default_seg_size << endl;
@@ -1172,8 +2559,22 @@ int main(int argc, char **argv)
     cout << "max_peer = " << max_peer << endl;
     cout << "model_version = " << model_version << endl;
     cout << "model_config = " << model_config << endl;
+    cout << "trace = " << trace << endl;
+    Profile *profile = profile_file.empty() ? NULL : new Profile();
+
+    // the id maps need the background workers of every parameter set of the sweep
+    vector<SweepConfig> sweep_configs;
+    if (!sweep_file.empty())
+    {
+        load_sweep_configs(sweep_file, sweep_configs);
+        for (size_t i = 0; i < sweep_configs.size(); i++)
+        {
+            num_bgworks = std::max(num_bgworks, sweep_configs[i].num_bgworks);
+        }
+    }
 
     MachineModel *machine = NULL;
+    ProfilePhase machine_phase(profile, "machine_model");
     if (model_version == 0)
     {
         machine = create_simple_machine_model();
@@ -1182,12 +2583,114 @@ int main(int argc, char **argv)
     {
         machine = create_enhanced_machine_model(model_config);
     }
+    machine_phase.stop();
+
+    // per-task trace: none (summary only), text (stdout or trace_file) or binary (trace_file)
+    TraceSink *trace_sink = NULL;
+    std::ofstream trace_stream;
+    if (trace == "text")
+    {
+        if (trace_file.empty())
+        {
+            trace_sink = new TextTraceSink(cout);
+        }
+        else
+        {
+            trace_stream.open(trace_file);
+            trace_sink = new TextTraceSink(trace_stream);
+        }
+    }
+    else if (trace == "binary")
+    {
+        if (trace_file.empty())
+        {
+            cout << "--trace binary requires --trace_file" << endl;
+            assert(0);
+        }
+        trace_sink = new BinaryTraceSink(trace_file);
+    }
+    else if (trace != "none")
+    {
+        cout << "Unknown trace sink " << trace << endl;
+        assert(0);
+    }
+
+    // the critical-path report forwards the records to the trace
+    CriticalPathSink *critical_path_sink = NULL;
+    std::ofstream critical_path_stream;
+    if (!critical_path_file.empty())
+    {
+        if (critical_path_file != "-")
+        {
+            critical_path_stream.open(critical_path_file);
+        }
+        critical_path_sink =
+            new CriticalPathSink(critical_path_file == "-" ? cout : critical_path_stream, trace_sink);
+    }
+
+    // the memory report forwards the records to the critical-path report or the trace
+    MemorySink *memory_sink = NULL;
+    std::ofstream memory_report_stream;
+    if (if_memory_check and memory_report_file.empty())
+    {
+        memory_report_file = "-";
+    }
+    if (!memory_report_file.empty())
+    {
+        if (memory_report_file != "-")
+        {
+            memory_report_stream.open(memory_report_file);
+        }
+        memory_sink = new MemorySink(memory_report_file == "-" ? cout : memory_report_stream,
+                                     critical_path_sink != NULL ? (TraceSink *)critical_path_sink : trace_sink);
+    }
 
-    Simulator simulator(machine);
+    Simulator simulator(machine, queue_type);
+    if (memory_sink != NULL)
+    {
+        simulator.set_trace_sink(memory_sink);
+    }
+    else
+    {
+        simulator.set_trace_sink(critical_path_sink != NULL ? critical_path_sink : trace_sink);
+    }
+    simulator.set_engine(engine, num_threads);
+    simulator.set_profile(profile);
+    simulator.set_iteration_folding(fold_tolerance);
+    simulator.set_flow_model(if_flow_model);
+    simulator.set_macro_transfers(if_macro_transfers);
+    simulator.set_seed(seed);
     std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // the report of the last simulation
+    auto out_of_memory = [&]() {
+        if (if_memory_check and memory_sink->oom_task != MemorySink::NO_TASK)
+        {
+            cout << "Out of memory in " << memory_sink->oom_mem->name << endl;
+            return true;
+        }
+        return false;
+    };
+    if (!simdag_file.empty())
+    {
+        DagTrace trace;
+        load_dag_trace(trace, log_folder, profile);
+        write_simdag(trace, simdag_file);
+    }
     if (if_run_dag_file)
     {
-        run_dag_file(simulator, machine, log_folder);
+        run_dag_file(simulator, log_folder);
+        if (out_of_memory())
+        {
+            return 1;
+        }
+    }
+    if (!sweep_file.empty())
+    {
+        run_sweep(sweep_configs, machine, model_config, log_folder, queue_type, sweep_threads, seed, profile);
+    }
+    if (ensemble_seeds > 0)
+    {
+        run_ensemble(ensemble_seeds, seed, machine, model_config, log_folder, queue_type, ensemble_threads, profile);
     }
     if (if_test_comm)
     {
@@ -1197,8 +2700,50 @@ int main(int argc, char **argv)
     {
         test_congestion(simulator, machine, message_size, max_peer);
     }
+    if (!collective.empty())
+    {
+        test_collective(simulator, machine, message_size, collective);
+    }
+    if ((if_test_comm or if_test_congestion or !collective.empty()) and out_of_memory())
+    {
+        return 1;
+    }
+    if (if_device_stats)
+    {
+        simulator.print_device_stats();
+    }
+    if (bench_max_threads > 0)
+    {
+        bench_threads(simulator, engine == Simulator::SEQUENTIAL_ENGINE ? Simulator::CONSERVATIVE_ENGINE : engine,
+                      bench_max_threads);
+    }
+    if (bench_edits > 0)
+    {
+        bench_incremental(simulator, bench_edits);
+    }
+    if (bench_queue_size > 0)
+    {
+        bench_ready_queue(bench_queue_size, bench_queue_size * 10);
+    }
     // stencil_1d_cpu();
     std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
     std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double> >(stop - start);
     cout << "simulator runs: " << time_span.count() << " seconds" << endl;
+    if (profile != NULL)
+    {
+        if (profile_file == "-")
+        {
+            profile->write_json(cout);
+        }
+        else
+        {
+            std::ofstream profile_stream(profile_file);
+            profile->write_json(profile_stream);
+        }
+        delete profile;
+    }
+    delete memory_sink;
+    delete critical_path_sink;
+    delete trace_sink;
+    delete machine;
 }
@@ -0,0 +1,868 @@
+#include "simulator.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace
+{
+
+// A reusable barrier for a fixed number of threads
+class Barrier
+{
+public:
+    Barrier(int num_threads) : num_threads(num_threads), num_waiting(0), generation(0) {}
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        unsigned long cur_generation = generation;
+        if (++num_waiting == num_threads)
+        {
+            num_waiting = 0;
+            generation++;
+            cond.notify_all();
+        }
+        else
+        {
+            cond.wait(lock, [&] { return generation != cur_generation; });
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cond;
+    int num_threads;
+    int num_waiting;
+    unsigned long generation;
+};
+
+// A dependency that crosses partitions, delivered at the end of a window
+struct Message
+{
+    task_id_t task;
+    simtime_t end_time;
+};
+
+// A task simulated by a worker, accounted by the main thread in the sequential order
+struct LogEntry
+{
+    simtime_t ready_time;
+    task_id_t task;
+    int sub_device;
+    simtime_t device_ready_time;
+    simtime_t start_time;
+    simtime_t run_time;
+    simtime_t end_time;
+};
+
+struct Partition
+{
+    ReadyQueue *ready_queue;
+    simtime_t next_time; // ready time of the earliest task at the start of the current window
+    // double buffered by window parity: one is written by the worker while the other is read
+    std::vector<LogEntry> logs[2];
+    std::vector<std::vector<Message> > outboxes[2]; // indexed by the destination partition
+};
+
+// Partition the tasks by the node of their device, returns the number of partitions
+int partition_by_node(MachineModel *machine, TaskGraph const &graph, int num_threads, std::vector<int> &partitions)
+{
+    int num_nodes = machine->get_num_nodes();
+    int num_partitions = min(num_threads, num_nodes);
+    // nodes are assigned to partitions in contiguous ranges, devices that do not belong to a node go to partition 0
+    std::vector<int> device_partitions(machine->get_num_devices(), 0);
+    for (int i = 0; i < machine->get_num_devices(); i++)
+    {
+        int node_id = machine->get_device(i)->node_id;
+        if (node_id >= 0 and node_id < num_nodes)
+        {
+            device_partitions[i] = (int)((long)node_id * num_partitions / num_nodes);
+        }
+    }
+    partitions.resize(graph.num_tasks());
+    for (size_t i = 0; i < graph.num_tasks(); i++)
+    {
+        partitions[i] = device_partitions[graph.devices[i]->index];
+    }
+    return num_partitions;
+}
+
+} // namespace
+
+/**
+ * Conservative parallel simulation (Chandy-Misra style, synchronized in windows).
+ *
+ * Devices are partitioned by node and each partition is simulated by its own worker thread. A
+ * task only delays a task in another partition through an edge, and the delay is at least the
+ * cost of the source task, so the lookahead is the smallest cost of any task with a successor in
+ * another partition. In the NIC-based machine models these are the NIC tasks. Every window
+ * [T, T + lookahead), where T is the earliest ready time of all the partitions, is simulated
+ * independently by the workers and the cross-partition edges are delivered at the barrier.
+ *
+ * The result is identical to the sequential engine: a partition pops its tasks in the same
+ * (ready_time, id) order, and the main thread merges the logs of a window by the same key, so
+ * the totals and the trace are accumulated in the sequential order. The merge of a window
+ * overlaps with the simulation of the next one.
+ *
+ * Returns false without simulating if the graph has no positive lookahead or only one partition.
+ */
+bool Simulator::simulate_conservative(TaskGraph const &graph)
+{
+    std::vector<int> partitions;
+    int num_partitions = partition_by_node(machine, graph, num_threads, partitions);
+    if (num_partitions <= 1)
+    {
+        return false;
+    }
+    size_t num_tasks = graph.num_tasks();
+    simtime_t lookahead = SIMTIME_MAX;
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        for (uint32_t j = graph.next_offsets[i]; j < graph.next_offsets[i + 1]; j++)
+        {
+            if (partitions[graph.next_tasks[j]] != partitions[i])
+            {
+                lookahead = min(lookahead, run.costs[i]);
+                break;
+            }
+        }
+    }
+    if (!(lookahead > 0))
+    {
+        return false;
+    }
+
+    std::vector<Partition> parts(num_partitions);
+    for (int p = 0; p < num_partitions; p++)
+    {
+        parts[p].ready_queue = ReadyQueue::create(queue_type);
+        parts[p].outboxes[0].resize(num_partitions);
+        parts[p].outboxes[1].resize(num_partitions);
+    }
+    for (size_t i = 0; i < graph.start_tasks.size(); i++)
+    {
+        task_id_t task = graph.start_tasks[i];
+        parts[partitions[task]].ready_queue->push({0, task});
+    }
+
+    Barrier window_start(num_partitions);
+    Barrier window_end(num_partitions + 1);
+    bool finished[2] = {false, false}; // set in the window that found nothing left to simulate
+    auto worker = [&](int p) {
+        Partition &part = parts[p];
+        ReadyQueue *queue = part.ready_queue;
+        for (int window = 0;; window++)
+        {
+            int cur = window & 1;
+            int prev = cur ^ 1;
+            // deliver the messages sent to this partition in the previous window
+            for (int q = 0; q < num_partitions; q++)
+            {
+                std::vector<Message> &inbox = parts[q].outboxes[prev][p];
+                for (size_t i = 0; i < inbox.size(); i++)
+                {
+                    task_id_t next = inbox[i].task;
+                    run.ready_times[next] = max(run.ready_times[next], inbox[i].end_time);
+                    run.counters[next]--;
+                    if (run.counters[next] == 0)
+                    {
+                        queue->push({run.ready_times[next], next});
+                    }
+                }
+                inbox.clear();
+            }
+            part.next_time = queue->empty() ? SIMTIME_MAX : queue->top().ready_time;
+            window_start.wait();
+            simtime_t window_begin = SIMTIME_MAX;
+            for (int q = 0; q < num_partitions; q++)
+            {
+                window_begin = min(window_begin, parts[q].next_time);
+            }
+            if (window_begin == SIMTIME_MAX)
+            {
+                if (p == 0)
+                {
+                    finished[cur] = true;
+                }
+                window_end.wait();
+                return;
+            }
+            simtime_t window_stop = lookahead < SIMTIME_MAX - window_begin ? window_begin + lookahead : SIMTIME_MAX;
+            std::vector<LogEntry> &log = part.logs[cur];
+            std::vector<std::vector<Message> > &outbox = part.outboxes[cur];
+            while (!queue->empty() and queue->top().ready_time < window_stop)
+            {
+                task_id_t cur_task = queue->pop().id;
+                SubDevice *cur_sub_device = run.get_avail_sub_device(run.devices[cur_task]);
+                simtime_t ready_time = run.sub_device_times[cur_sub_device->index];
+                simtime_t start_time = max(ready_time, run.ready_times[cur_task]);
+                simtime_t run_time = run.costs[cur_task];
+                simtime_t end_time = start_time + run_time;
+                run.sub_device_times[cur_sub_device->index] = end_time;
+                run.sub_device_busy_times[cur_sub_device->index] += run_time;
+                run.sub_device_num_tasks[cur_sub_device->index]++;
+                run.update_sub_device(cur_sub_device);
+                log.push_back({run.ready_times[cur_task], cur_task, cur_sub_device->index, ready_time, start_time,
+                               run_time, end_time});
+                for (uint32_t i = graph.next_offsets[cur_task]; i < graph.next_offsets[cur_task + 1]; i++)
+                {
+                    task_id_t next = graph.next_tasks[i];
+                    if (partitions[next] != p)
+                    {
+                        outbox[partitions[next]].push_back({next, end_time});
+                        continue;
+                    }
+                    run.ready_times[next] = max(run.ready_times[next], end_time);
+                    run.counters[next]--;
+                    if (run.counters[next] == 0)
+                    {
+                        queue->push({run.ready_times[next], next});
+                    }
+                }
+            }
+            window_end.wait();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int p = 0; p < num_partitions; p++)
+    {
+        workers.push_back(std::thread(worker, p));
+    }
+
+    // merge the logs of each window by (ready_time, id), which is the order of the sequential engine
+    std::vector<size_t> heads(num_partitions);
+    for (int window = 0;; window++)
+    {
+        int cur = window & 1;
+        window_end.wait();
+        if (finished[cur])
+        {
+            break;
+        }
+        std::fill(heads.begin(), heads.end(), 0);
+        while (true)
+        {
+            int next_part = -1;
+            for (int p = 0; p < num_partitions; p++)
+            {
+                std::vector<LogEntry> &log = parts[p].logs[cur];
+                if (heads[p] == log.size())
+                {
+                    continue;
+                }
+                if (next_part == -1)
+                {
+                    next_part = p;
+                    continue;
+                }
+                LogEntry const &best = parts[next_part].logs[cur][heads[next_part]];
+                if (TaskCompare()({best.ready_time, best.task}, {log[heads[p]].ready_time, log[heads[p]].task}))
+                {
+                    next_part = p;
+                }
+            }
+            if (next_part == -1)
+            {
+                break;
+            }
+            LogEntry const &entry = parts[next_part].logs[cur][heads[next_part]++];
+            account(graph, entry.task, machine->get_sub_device(entry.sub_device), entry.ready_time, entry.device_ready_time,
+                    entry.start_time, entry.run_time, entry.end_time);
+        }
+        for (int p = 0; p < num_partitions; p++)
+        {
+            parts[p].logs[cur].clear();
+        }
+    }
+    for (int p = 0; p < num_partitions; p++)
+    {
+        workers[p].join();
+        if (profile != nullptr)
+        {
+            profile->add_queue_stats(parts[p].ready_queue->stats);
+        }
+        delete parts[p].ready_queue;
+    }
+    return true;
+}
+
+namespace
+{
+
+// Number of events a partition of the optimistic engine simulates between two GVT computations
+const int OPTIMISTIC_BATCH_SIZE = 1024;
+
+const ReadyTask MIN_VIRTUAL_TIME = {-SIMTIME_MAX, 0};
+const ReadyTask MAX_VIRTUAL_TIME = {SIMTIME_MAX, UINT32_MAX};
+
+inline bool before(ReadyTask const &lhs, ReadyTask const &rhs)
+{
+    return TaskCompare()(rhs, lhs);
+}
+
+// A ready task of the optimistic engine, ordered by (vt, key)
+struct Event
+{
+    ReadyTask vt;  // virtual time, see simulate_optimistic()
+    ReadyTask key; // (ready_time, id) as in the sequential engine
+    uint32_t seq;  // an event is cancelled when the task's seq has changed
+};
+
+struct EventCompare
+{
+    bool operator()(Event const &lhs, Event const &rhs) const
+    {
+        if (before(lhs.vt, rhs.vt) or before(rhs.vt, lhs.vt))
+        {
+            return before(rhs.vt, lhs.vt);
+        }
+        return before(rhs.key, lhs.key);
+    }
+};
+
+// An edge to another partition, or its cancellation when anti is set
+struct EdgeMessage
+{
+    uint32_t edge; // index into TaskGraph::next_tasks
+    simtime_t end_time;
+    ReadyTask vt;
+    bool anti;
+};
+
+// A processed event with the state it overwrote
+struct ProcessedEvent
+{
+    Event event;
+    int prev_cur_sub_device;
+    simtime_t prev_busy_time;
+    LogEntry log; // log.device_ready_time is the previous time of the sub-device
+    bool unsafe;  // sent an edge to another partition without delay, see simulate_optimistic()
+};
+
+// State shared by the partitions, each element is only accessed by the partition that owns its task
+struct TimeWarpState
+{
+    TaskGraph const &graph;
+    RunState &run;
+    std::vector<int> partitions;
+    // predecessors of each task as indices of their edges in graph.next_tasks, in CSR form
+    std::vector<uint32_t> prev_offsets;
+    std::vector<uint32_t> prev_edges;
+    // the end time and virtual time each edge delivered, valid while edge_done is set
+    std::vector<simtime_t> edge_ends;
+    std::vector<ReadyTask> edge_vts;
+    std::vector<char> edge_done;
+    std::vector<ReadyTask> prev_vts;  // latest virtual time of the delivered predecessors of each task
+    std::vector<uint32_t> ready_seqs; // seq of the live event of each task
+    std::vector<long> history_pos;    // position of the processed event of each task in its partition, -1 if none
+
+    TimeWarpState(TaskGraph const &graph, RunState &run) : graph(graph), run(run) {}
+};
+
+/**
+ * A logical process of the optimistic engine. Events are simulated speculatively in (vt, key)
+ * order and saved in the history with the state they overwrite. A straggler, an edge from another
+ * partition that makes a task ready before events that were already simulated, rolls the history
+ * back to where the task belongs. Undoing an event re-queues it and cancels the edges it sent to
+ * other partitions with anti-messages. Events before the GVT can no longer be rolled back and are
+ * moved out of the history by commit().
+ */
+class TimeWarpPartition
+{
+public:
+    TimeWarpPartition(int id, TimeWarpState &state, std::vector<TimeWarpPartition *> &partitions)
+        : id(id), state(state), partitions(partitions), history_base(0), has_messages(false)
+    {
+    }
+    void push_start_task(task_id_t task)
+    {
+        queue.push({{0, task}, {0, task}, 0});
+    }
+    void send(EdgeMessage const &message)
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex);
+        inbox.push_back(message);
+        has_messages.store(true, std::memory_order_release);
+    }
+    // apply the messages received so far, returns false if there were none
+    bool receive()
+    {
+        if (!has_messages.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(inbox_mutex);
+            received.swap(inbox);
+            has_messages.store(false, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < received.size(); i++)
+        {
+            if (received[i].anti)
+            {
+                cancel_edge(received[i].edge);
+            }
+            else
+            {
+                deliver_edge(received[i].edge, received[i].end_time, received[i].vt, true);
+            }
+        }
+        received.clear();
+        return true;
+    }
+    // simulate the next event, returns false if there is none
+    bool process_next()
+    {
+        if (!drop_cancelled())
+        {
+            return false;
+        }
+        Event event = queue.top();
+        queue.pop();
+        process(event);
+        return true;
+    }
+    // a lower bound of the virtual time of everything this partition can still roll back to
+    ReadyTask min_virtual_time()
+    {
+        ReadyTask ret = drop_cancelled() ? queue.top().vt : MAX_VIRTUAL_TIME;
+        std::lock_guard<std::mutex> lock(inbox_mutex);
+        for (size_t i = 0; i < inbox.size(); i++)
+        {
+            if (before(inbox[i].vt, ret))
+            {
+                ret = inbox[i].vt;
+            }
+        }
+        return ret;
+    }
+    ReadyTask min_unsafe_virtual_time() const
+    {
+        for (size_t i = 0; i < history.size(); i++)
+        {
+            if (history[i].unsafe)
+            {
+                return history[i].event.vt;
+            }
+        }
+        return MAX_VIRTUAL_TIME;
+    }
+    // move the events before gvt out of the history
+    void commit(ReadyTask const &gvt, std::vector<ProcessedEvent> &committed)
+    {
+        while (!history.empty() and before(history.front().event.vt, gvt))
+        {
+            committed.push_back(history.front());
+            history.pop_front();
+            history_base++;
+        }
+    }
+    // roll back all the events at or after vt, returns false if there were none
+    bool rollback_from(ReadyTask const &vt)
+    {
+        bool ret = false;
+        while (!history.empty() and !before(history.back().event.vt, vt))
+        {
+            undo_last();
+            ret = true;
+        }
+        return ret;
+    }
+    // move the live events to the ready queue of the sequential engine
+    void move_events(ReadyQueue *ready_queue)
+    {
+        while (drop_cancelled())
+        {
+            ready_queue->push(queue.top().key);
+            queue.pop();
+        }
+    }
+
+private:
+    int id;
+    TimeWarpState &state;
+    std::vector<TimeWarpPartition *> &partitions;
+    std::priority_queue<Event, std::vector<Event>, EventCompare> queue;
+    std::deque<ProcessedEvent> history; // in (vt, key) order up to the dips of the zero-delay edges
+    long history_base;                  // position of history.front()
+    std::mutex inbox_mutex;
+    std::vector<EdgeMessage> inbox;
+    std::vector<EdgeMessage> received;
+    std::atomic<bool> has_messages;
+
+    bool is_live(Event const &event) const
+    {
+        task_id_t task = event.key.id;
+        return event.seq == state.ready_seqs[task] and state.run.counters[task] == 0;
+    }
+    // pop the cancelled events on the top of the queue, returns false if the queue becomes empty
+    bool drop_cancelled()
+    {
+        while (!queue.empty() and !is_live(queue.top()))
+        {
+            queue.pop();
+        }
+        return !queue.empty();
+    }
+    void process(Event const &event)
+    {
+        TaskGraph const &graph = state.graph;
+        task_id_t task = event.key.id;
+        Device *device = state.run.devices[task];
+        ProcessedEvent processed;
+        processed.event = event;
+        processed.prev_cur_sub_device = state.run.cur_sub_devices[device->index];
+        processed.unsafe = false;
+        SubDevice *sub_device = state.run.get_avail_sub_device(device);
+        int index = sub_device->index;
+        simtime_t ready_time = state.run.sub_device_times[index];
+        simtime_t start_time = max(ready_time, state.run.ready_times[task]);
+        simtime_t run_time = state.run.costs[task];
+        simtime_t end_time = start_time + run_time;
+        processed.prev_busy_time = state.run.sub_device_busy_times[index];
+        state.run.sub_device_times[index] = end_time;
+        state.run.sub_device_busy_times[index] += run_time;
+        state.run.sub_device_num_tasks[index]++;
+        state.run.update_sub_device(sub_device);
+        processed.log = {state.run.ready_times[task], task, index, ready_time, start_time, run_time, end_time};
+        state.history_pos[task] = history_base + history.size();
+        for (uint32_t i = graph.next_offsets[task]; i < graph.next_offsets[task + 1]; i++)
+        {
+            int partition = state.partitions[graph.next_tasks[i]];
+            if (partition == id)
+            {
+                deliver_edge(i, end_time, event.vt, false);
+            }
+            else
+            {
+                partitions[partition]->send({i, end_time, event.vt, false});
+                processed.unsafe |= end_time == event.vt.ready_time;
+            }
+        }
+        history.push_back(processed);
+    }
+    void undo_last()
+    {
+        TaskGraph const &graph = state.graph;
+        ProcessedEvent const &processed = history.back();
+        task_id_t task = processed.event.key.id;
+        for (uint32_t i = graph.next_offsets[task + 1]; i-- > graph.next_offsets[task];)
+        {
+            int partition = state.partitions[graph.next_tasks[i]];
+            if (partition == id)
+            {
+                retract_edge(i);
+            }
+            else
+            {
+                partitions[partition]->send({i, 0, processed.event.vt, true});
+            }
+        }
+        int index = processed.log.sub_device;
+        Device const *device = state.run.devices[task];
+        state.run.cur_sub_devices[device->index] = processed.prev_cur_sub_device;
+        state.run.sub_device_times[index] = processed.log.device_ready_time;
+        state.run.sub_device_busy_times[index] = processed.prev_busy_time;
+        state.run.sub_device_num_tasks[index]--;
+        state.run.update_sub_device(device->sub_devices[index - device->sub_devices[0]->index]);
+        state.history_pos[task] = -1;
+        queue.push(processed.event);
+        history.pop_back();
+    }
+    void rollback_to(long pos)
+    {
+        while (history_base + (long)history.size() > pos)
+        {
+            undo_last();
+        }
+    }
+    void deliver_edge(uint32_t edge, simtime_t end_time, ReadyTask const &vt, bool from_other_partition)
+    {
+        task_id_t task = state.graph.next_tasks[edge];
+        state.edge_ends[edge] = end_time;
+        state.edge_vts[edge] = vt;
+        state.edge_done[edge] = 1;
+        state.run.ready_times[task] = max(state.run.ready_times[task], end_time);
+        if (before(state.prev_vts[task], vt))
+        {
+            state.prev_vts[task] = vt;
+        }
+        if (--state.run.counters[task] != 0)
+        {
+            return;
+        }
+        Event event;
+        event.key = {state.run.ready_times[task], task};
+        event.vt = before(event.key, state.prev_vts[task]) ? state.prev_vts[task] : event.key;
+        if (from_other_partition and !history.empty() and EventCompare()(history.back().event, event))
+        {
+            // a straggler: roll back from the first simulated event that comes after it
+            size_t pos = std::lower_bound(history.begin(), history.end(), event.vt,
+                                          [](ProcessedEvent const &processed, ReadyTask const &vt) {
+                                              return before(processed.event.vt, vt);
+                                          }) -
+                         history.begin();
+            while (pos < history.size() and !EventCompare()(history[pos].event, event))
+            {
+                pos++;
+            }
+            rollback_to(history_base + pos);
+            if (state.run.counters[task] != 0)
+            {
+                return; // an undone event delivered another edge of the task
+            }
+        }
+        event.seq = ++state.ready_seqs[task];
+        queue.push(event);
+    }
+    void retract_edge(uint32_t edge)
+    {
+        TaskGraph const &graph = state.graph;
+        task_id_t task = graph.next_tasks[edge];
+        if (state.run.counters[task] == 0)
+        {
+            state.ready_seqs[task]++;
+        }
+        state.edge_done[edge] = 0;
+        state.run.counters[task]++;
+        state.run.ready_times[task] = 0;
+        state.prev_vts[task] = MIN_VIRTUAL_TIME;
+        for (uint32_t i = state.prev_offsets[task]; i < state.prev_offsets[task + 1]; i++)
+        {
+            uint32_t prev_edge = state.prev_edges[i];
+            if (state.edge_done[prev_edge])
+            {
+                state.run.ready_times[task] = max(state.run.ready_times[task], state.edge_ends[prev_edge]);
+                if (before(state.prev_vts[task], state.edge_vts[prev_edge]))
+                {
+                    state.prev_vts[task] = state.edge_vts[prev_edge];
+                }
+            }
+        }
+    }
+    void cancel_edge(uint32_t edge)
+    {
+        task_id_t task = state.graph.next_tasks[edge];
+        if (state.run.counters[task] == 0 and state.history_pos[task] >= 0)
+        {
+            rollback_to(state.history_pos[task]);
+        }
+        retract_edge(edge);
+    }
+};
+
+} // namespace
+
+/**
+ * Optimistic parallel simulation (Time Warp, Jefferson 1985).
+ *
+ * Tasks are partitioned by node as in simulate_conservative(), but the partitions do not wait for
+ * each other: each one simulates its ready tasks speculatively and rolls back when an edge from
+ * another partition arrives late, so no lookahead is needed. Every OPTIMISTIC_BATCH_SIZE events the
+ * workers stop and compute the global virtual time (GVT), the smallest virtual time that is still
+ * queued or in a message. The events before the GVT are committed: their saved state is dropped
+ * and the main thread merges them into the totals and the trace while the workers continue.
+ *
+ * The virtual time of a task is the larger of its (ready_time, id) key and the virtual times of its
+ * predecessors. The sequential engine pops the tasks in the order of their virtual times, except
+ * that the tasks sharing a virtual time, which are enabled without delay by a task popped at that
+ * time, are popped in key order as they become ready. As long as such a group of tasks stays in one
+ * partition, ordering the events by (vt, key) reproduces the sequential engine exactly. A group can
+ * only cross partitions through an edge without delay, so events that send one are marked unsafe.
+ * Once an unsafe event is before the GVT, everything from it on is rolled back and the rest of the
+ * graph is simulated by the sequential engine.
+ *
+ * Returns false without simulating if there is only one partition or a start task has predecessors.
+ */
+bool Simulator::simulate_optimistic(TaskGraph const &graph)
+{
+    TimeWarpState state(graph, run);
+    int num_partitions = partition_by_node(machine, graph, num_threads, state.partitions);
+    if (num_partitions <= 1)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < graph.start_tasks.size(); i++)
+    {
+        if (graph.num_prev_tasks[graph.start_tasks[i]] != 0)
+        {
+            return false;
+        }
+    }
+    size_t num_tasks = graph.num_tasks();
+    size_t num_edges = graph.next_tasks.size();
+    state.prev_offsets.assign(num_tasks + 1, 0);
+    for (size_t i = 0; i < num_edges; i++)
+    {
+        state.prev_offsets[graph.next_tasks[i] + 1]++;
+    }
+    for (size_t i = 0; i < num_tasks; i++)
+    {
+        state.prev_offsets[i + 1] += state.prev_offsets[i];
+    }
+    state.prev_edges.resize(num_edges);
+    std::vector<uint32_t> fill(state.prev_offsets.begin(), state.prev_offsets.end() - 1);
+    for (size_t i = 0; i < num_edges; i++)
+    {
+        state.prev_edges[fill[graph.next_tasks[i]]++] = i;
+    }
+    state.edge_ends.assign(num_edges, 0);
+    state.edge_vts.assign(num_edges, MIN_VIRTUAL_TIME);
+    state.edge_done.assign(num_edges, 0);
+    state.prev_vts.assign(num_tasks, MIN_VIRTUAL_TIME);
+    state.ready_seqs.assign(num_tasks, 0);
+    state.history_pos.assign(num_tasks, -1);
+
+    std::vector<TimeWarpPartition *> parts;
+    for (int p = 0; p < num_partitions; p++)
+    {
+        parts.push_back(new TimeWarpPartition(p, state, parts));
+    }
+    for (size_t i = 0; i < graph.start_tasks.size(); i++)
+    {
+        parts[state.partitions[graph.start_tasks[i]]]->push_start_task(graph.start_tasks[i]);
+    }
+
+    enum Status
+    {
+        RUNNING,
+        FINISHED,
+        UNSAFE,
+    };
+    Barrier batch_stop(num_partitions);
+    Barrier gvt_ready(num_partitions);
+    Barrier batch_commit(num_partitions + 1);
+    std::vector<ReadyTask> min_vts(num_partitions);
+    std::vector<ReadyTask> min_unsafe_vts(num_partitions);
+    // double buffered by batch parity, like the logs of simulate_conservative()
+    std::vector<std::vector<ProcessedEvent> > committed[2];
+    committed[0].resize(num_partitions);
+    committed[1].resize(num_partitions);
+    Status status[2] = {RUNNING, RUNNING};
+    ReadyTask unsafe_vt = MAX_VIRTUAL_TIME;
+    auto worker = [&](int p) {
+        TimeWarpPartition &part = *parts[p];
+        for (int batch = 0;; batch++)
+        {
+            int cur = batch & 1;
+            for (int i = 0; i < OPTIMISTIC_BATCH_SIZE; i++)
+            {
+                part.receive();
+                if (!part.process_next())
+                {
+                    break;
+                }
+            }
+            batch_stop.wait();
+            // nothing is sent until the next batch, so every message is in an inbox
+            min_vts[p] = part.min_virtual_time();
+            min_unsafe_vts[p] = part.min_unsafe_virtual_time();
+            gvt_ready.wait();
+            ReadyTask gvt = MAX_VIRTUAL_TIME;
+            ReadyTask min_unsafe_vt = MAX_VIRTUAL_TIME;
+            for (int q = 0; q < num_partitions; q++)
+            {
+                gvt = before(min_vts[q], gvt) ? min_vts[q] : gvt;
+                min_unsafe_vt = before(min_unsafe_vts[q], min_unsafe_vt) ? min_unsafe_vts[q] : min_unsafe_vt;
+            }
+            if (before(min_unsafe_vt, gvt))
+            {
+                if (p == 0)
+                {
+                    unsafe_vt = min_unsafe_vt;
+                    status[cur] = UNSAFE;
+                }
+                batch_commit.wait();
+                return;
+            }
+            part.commit(gvt, committed[cur][p]);
+            if (p == 0 and gvt.ready_time == SIMTIME_MAX)
+            {
+                status[cur] = FINISHED;
+            }
+            batch_commit.wait();
+            if (status[cur] == FINISHED)
+            {
+                return;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int p = 0; p < num_partitions; p++)
+    {
+        workers.push_back(std::thread(worker, p));
+    }
+
+    // merge the committed events by virtual time, which is the order of the sequential engine
+    std::vector<size_t> heads(num_partitions);
+    auto merge = [&](std::vector<std::vector<ProcessedEvent> > &events) {
+        std::fill(heads.begin(), heads.end(), 0);
+        while (true)
+        {
+            int next_part = -1;
+            for (int p = 0; p < num_partitions; p++)
+            {
+                if (heads[p] < events[p].size() and
+                    (next_part == -1 or before(events[p][heads[p]].event.vt, events[next_part][heads[next_part]].event.vt)))
+                {
+                    next_part = p;
+                }
+            }
+            if (next_part == -1)
+            {
+                break;
+            }
+            LogEntry const &log = events[next_part][heads[next_part]++].log;
+            account(graph, log.task, machine->get_sub_device(log.sub_device), log.ready_time, log.device_ready_time,
+                    log.start_time, log.run_time, log.end_time);
+        }
+        for (int p = 0; p < num_partitions; p++)
+        {
+            events[p].clear();
+        }
+    };
+    Status result = RUNNING;
+    for (int batch = 0; result == RUNNING; batch++)
+    {
+        int cur = batch & 1;
+        batch_commit.wait();
+        merge(committed[cur]);
+        result = status[cur];
+    }
+    for (int p = 0; p < num_partitions; p++)
+    {
+        workers[p].join();
+    }
+
+    if (result == UNSAFE)
+    {
+        // deliver the messages in flight and roll every partition back to the first unsafe event
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (int p = 0; p < num_partitions; p++)
+            {
+                changed |= parts[p]->receive();
+                changed |= parts[p]->rollback_from(unsafe_vt);
+            }
+        }
+        for (int p = 0; p < num_partitions; p++)
+        {
+            parts[p]->commit(MAX_VIRTUAL_TIME, committed[0][p]);
+            parts[p]->move_events(ready_queue);
+        }
+        merge(committed[0]);
+        process_ready_queue(graph);
+    }
+    for (int p = 0; p < num_partitions; p++)
+    {
+        delete parts[p];
+    }
+    return true;
+}
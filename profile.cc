@@ -0,0 +1,112 @@
+#include "simulator.h"
+#include <sys/resource.h>
+
+// class Profile
+Profile::Profile()
+    : start(std::chrono::steady_clock::now())
+{
+}
+
+void Profile::add_time(std::string const &phase, double seconds)
+{
+    for (size_t i = 0; i < phases.size(); i++)
+    {
+        if (phases[i].first == phase)
+        {
+            phases[i].second += seconds;
+            return;
+        }
+    }
+    phases.push_back({phase, seconds});
+}
+
+uint64_t &Profile::get_counter(std::string const &counter)
+{
+    for (size_t i = 0; i < counters.size(); i++)
+    {
+        if (counters[i].first == counter)
+        {
+            return counters[i].second;
+        }
+    }
+    counters.push_back({counter, 0});
+    return counters.back().second;
+}
+
+void Profile::add_count(std::string const &counter, uint64_t value)
+{
+    get_counter(counter) += value;
+}
+
+void Profile::set_max(std::string const &counter, uint64_t value)
+{
+    uint64_t &cur = get_counter(counter);
+    if (value > cur)
+    {
+        cur = value;
+    }
+}
+
+void Profile::add_queue_stats(ReadyQueue::Stats const &stats)
+{
+    add_count("queue_pushes", stats.num_pushes);
+    add_count("queue_pops", stats.num_pops);
+    set_max("peak_queue_size", stats.peak_size);
+}
+
+void Profile::write_json(std::ostream &out) const
+{
+    double wall_time =
+        std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - start).count();
+    double simulate_time = 0.0;
+    uint64_t num_events = 0;
+    out << "{\n  \"wall_seconds\": " << wall_time << ",\n  \"phases\": {";
+    for (size_t i = 0; i < phases.size(); i++)
+    {
+        out << (i > 0 ? "," : "") << "\n    \"" << phases[i].first << "\": " << phases[i].second;
+        if (phases[i].first == "simulate")
+        {
+            simulate_time = phases[i].second;
+        }
+    }
+    out << "\n  },\n  \"counters\": {";
+    for (size_t i = 0; i < counters.size(); i++)
+    {
+        out << (i > 0 ? "," : "") << "\n    \"" << counters[i].first << "\": " << counters[i].second;
+        if (counters[i].first == "events")
+        {
+            num_events = counters[i].second;
+        }
+    }
+    // ru_maxrss is in kilobytes on Linux
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    out << "\n  },\n  \"peak_rss_bytes\": " << (uint64_t)usage.ru_maxrss * 1024 << ",\n  \"events_per_second\": "
+        << (simulate_time > 0.0 ? num_events / simulate_time : 0.0) << "\n}\n";
+}
+
+// class ProfilePhase
+ProfilePhase::ProfilePhase(Profile *profile, char const *phase)
+    : profile(profile), phase(phase)
+{
+    if (profile != nullptr)
+    {
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+ProfilePhase::~ProfilePhase()
+{
+    stop();
+}
+
+void ProfilePhase::stop()
+{
+    if (profile == nullptr)
+    {
+        return;
+    }
+    std::chrono::duration<double> time_span = std::chrono::steady_clock::now() - start;
+    profile->add_time(phase, time_span.count());
+    profile = nullptr;
+}
@@ -1,6 +1,8 @@
 #include "simulator.h"
 #include <chrono>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 
 using std::cout;
 using std::endl;
@@ -13,9 +15,9 @@ using std::vector;
 
 // class Device
 Device::Device(string name, DeviceType type, int node_id, int socket_id, int device_id, int max_sub_device = 1)
-    : name(name), type(type), node_id(node_id), socket_id(socket_id), device_id(device_id), max_sub_device(max_sub_device)
+    : name(name), type(type), index(-1), node_id(node_id), socket_id(socket_id), device_id(device_id), max_sub_device(max_sub_device),
+      sub_device_policy(ROUND_ROBIN)
 {
-    cur_sub_deivce = 0;
     sub_devices.reserve(max_sub_device);
     for (int i = 0; i < max_sub_device; i++)
     {
@@ -23,26 +25,17 @@ Device::Device(string name, DeviceType type, int node_id, int socket_id, int dev
     }
 }
 
-SubDevice *Device::get_avail_sub_device()
+Device::~Device()
 {
-    if (max_sub_device == 1)
+    for (size_t i = 0; i < sub_devices.size(); i++)
     {
-        return sub_devices[0];
-    }
-    else
-    {
-        SubDevice *ret = sub_devices[cur_sub_deivce++];
-        if (cur_sub_deivce == max_sub_device)
-        {
-            cur_sub_deivce = 0;
-        }
-        return ret;
+        delete sub_devices[i];
     }
 }
 
 // class SubDevice
 SubDevice::SubDevice(Device *main_device, int sub_device_id)
-    : main_device(main_device), sub_device_id(sub_device_id)
+    : main_device(main_device), sub_device_id(sub_device_id), index(-1)
 {
 }
 
@@ -54,7 +47,7 @@ CompDevice::CompDevice(std::string name, CompDevType comp_type, int node_id, int
 
 // class MemDevice
 MemDevice::MemDevice(std::string name, MemDevType mem_type, int node_id, int socket_id, int device_id)
-    : Device(name, Device::DEVICE_MEM, node_id, socket_id, device_id), mem_type(mem_type)
+    : Device(name, Device::DEVICE_MEM, node_id, socket_id, device_id), mem_type(mem_type), mem_index(-1), capacity(0)
 {
 }
 
@@ -64,31 +57,71 @@ CommDevice::CommDevice(std::string name, CommDevType comm_type, int node_id, int
 {
 }
 
-// class Task
-size_t Task::cur_id{0};
+// class TaskName
+TaskName::TaskName()
+    : kind(TEXT), segment(0), text(nullptr), tar(nullptr)
+{
+}
 
-Task::Task(string name, Device *device)
-    : name(name), device(device), ready_time(0.0f), counter(0), is_main(false)
+TaskName::TaskName(string const *text)
+    : kind(TEXT), segment(0), text(text), tar(nullptr)
+{
+}
+
+TaskName::TaskName(NameKind kind, int64_t number)
+    : kind(kind), segment(0), number(number), tar(nullptr)
+{
+}
+
+TaskName::TaskName(NameKind kind, string const *text, uint32_t segment)
+    : kind(kind), segment(segment), text(text), tar(nullptr)
 {
-    next_tasks.clear();
-    id = cur_id++;
 }
 
-void Task::add_next_task(Task *task)
+TaskName::TaskName(NameKind kind, Task const *src, Task const *tar, uint32_t segment)
+    : kind(kind), segment(segment), src(src), tar(tar)
+{
+}
+
+string TaskName::to_string() const
+{
+    switch (kind)
+    {
+    case TEXT:
+        return text != nullptr ? *text : "";
+    case OP_NODE:
+        return "op_node_" + std::to_string(number);
+    case REALM_COPY:
+        return "realm_copy_" + std::to_string(number);
+    case REALM_FILL:
+        return "realm_fill_" + std::to_string(number);
+    case SEGMENT:
+        return "seg " + std::to_string(segment) + " from " + src->name.to_string() + " to " + tar->name.to_string();
+    case FLOW:
+        return "flow from " + src->name.to_string() + " to " + tar->name.to_string();
+    case TRANSFER:
+        return "transfer from " + src->name.to_string() + " to " + tar->name.to_string();
+    case STEP:
+        return *text + " step " + std::to_string(segment);
+    }
+    return "";
+}
+
+// class Task
+Task::Task(TaskName name, Device *device)
+    : id(0), name(name), device(device), is_main(false), kind(nullptr)
 {
-    next_tasks.push_back(task);
-    task->counter++;
 }
 
 // class CompTask
-CompTask::CompTask(std::string name, CompDevice *comp_deivce, float run_time, MemDevice *mem_device)
+CompTask::CompTask(TaskName name, CompDevice *comp_deivce, float run_time, MemDevice *mem_device)
     : Task(name, comp_deivce), run_time(run_time), mem(mem_device)
 {
 }
 
 string CompTask::to_string() const
 {
-    return name + "(" + device->name + ',' + std::to_string(counter) + ',' + std::to_string(run_time) + "ms," + mem->name + ")";
+    return name.to_string() + "(" + device->name + ',' + std::to_string(run_time) + "ms," + mem->name + ")";
 }
 
 float CompTask::cost() const
@@ -97,41 +130,683 @@ float CompTask::cost() const
 }
 
 // class CommTask
-CommTask::CommTask(string name, CommDevice *comm_device, size_t message_size)
-    : Task(name, comm_device), message_size(message_size)
+CommTask::CommTask(TaskName name, CommDevice *comm_device, size_t message_size)
+    : Task(name, comm_device), message_size(message_size), num_segments(0), segment_size(0)
 {
 }
 
 string CommTask::to_string() const
 {
-    return name + "(" + device->name + ',' + std::to_string(counter) + ',' + std::to_string(message_size) + "B)";
+    return name.to_string() + "(" + device->name + ',' + std::to_string(message_size) + "B)";
 }
 
 float CommTask::cost() const
 {
-    CommDevice *comm = (CommDevice *)device;
-    return comm->latency + message_size / comm->bandwidth;
+    return cost(nullptr);
+}
+
+float CommTask::cost(MachineModel const *machine) const
+{
+    auto link = [&](Device *device) {
+        return (CommDevice const *)(machine != nullptr ? machine->get_device(device->index) : device);
+    };
+    if (path.empty())
+    {
+        CommDevice const *comm_device = link(device);
+        return comm_device->latency + message_size / comm_device->bandwidth;
+    }
+    if (num_segments > 0)
+    {
+        return pipelined_cost(machine);
+    }
+    // alone on its path, a flow runs at the bandwidth of the slowest link
+    float latency = 0;
+    float bandwidth = link(path[0])->bandwidth;
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        latency += link(path[i])->latency;
+        bandwidth = std::min(bandwidth, link(path[i])->bandwidth);
+    }
+    return latency + message_size / bandwidth;
+}
+
+// class TaskGraph
+TaskGraph::TaskGraph() : machine(nullptr)
+{
+}
+
+void TaskGraph::clear()
+{
+    tasks.clear();
+    devices.clear();
+    costs.clear();
+    num_prev_tasks.clear();
+    next_offsets.clear();
+    next_tasks.clear();
+    start_tasks.clear();
+    messages.clear();
+    new_edges.clear();
+}
+
+size_t TaskGraph::num_tasks() const
+{
+    return tasks.size();
+}
+
+task_id_t TaskGraph::add_task(Task *task, float cost)
+{
+    task_id_t id = tasks.size();
+    tasks.push_back(task);
+    devices.push_back(task->device);
+    costs.push_back(to_simtime(cost));
+    num_prev_tasks.push_back(0);
+    return id;
+}
+
+void TaskGraph::add_edge(task_id_t prev_task, task_id_t next_task)
+{
+    new_edges.push_back({prev_task, next_task});
+    num_prev_tasks[next_task]++;
+}
+
+void TaskGraph::finalize()
+{
+    size_t num_old_tasks = next_offsets.empty() ? 0 : next_offsets.size() - 1;
+    if (new_edges.empty() and num_old_tasks == tasks.size())
+    {
+        return;
+    }
+    // Counting sort of the edges by their source, keeping the order in which they were added
+    vector<uint32_t> offsets(tasks.size() + 1, 0);
+    for (size_t i = 0; i < num_old_tasks; i++)
+    {
+        offsets[i + 1] = next_offsets[i + 1] - next_offsets[i];
+    }
+    for (size_t i = 0; i < new_edges.size(); i++)
+    {
+        offsets[new_edges[i].first + 1]++;
+    }
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        offsets[i + 1] += offsets[i];
+    }
+    vector<task_id_t> edges(offsets.back());
+    vector<uint32_t> pos(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < num_old_tasks; i++)
+    {
+        for (uint32_t j = next_offsets[i]; j < next_offsets[i + 1]; j++)
+        {
+            edges[pos[i]++] = next_tasks[j];
+        }
+    }
+    for (size_t i = 0; i < new_edges.size(); i++)
+    {
+        edges[pos[new_edges[i].first]++] = new_edges[i].second;
+    }
+    next_offsets.swap(offsets);
+    next_tasks.swap(edges);
+    new_edges.clear();
+}
+
+bool TaskGraph::finalized() const
+{
+    return new_edges.empty() and next_offsets.size() == tasks.size() + 1;
+}
+
+size_t TaskGraph::bytes_reserved() const
+{
+    return tasks.capacity() * sizeof(Task *) + devices.capacity() * sizeof(Device *) +
+           costs.capacity() * sizeof(simtime_t) + num_prev_tasks.capacity() * sizeof(int) +
+           next_offsets.capacity() * sizeof(uint32_t) + next_tasks.capacity() * sizeof(task_id_t) +
+           start_tasks.capacity() * sizeof(task_id_t) + messages.capacity() * sizeof(Message) +
+           new_edges.capacity() * sizeof(new_edges[0]);
+}
+
+// class RunState
+void RunState::init(TaskGraph const &graph, MachineModel *machine)
+{
+    assert(graph.finalized());
+    size_t num_tasks = graph.num_tasks();
+    if (machine == graph.machine)
+    {
+        devices = graph.devices;
+        costs = graph.costs;
+    }
+    else
+    {
+        assert(machine->get_num_devices() == graph.machine->get_num_devices());
+        assert(machine->get_num_sub_devices() == graph.machine->get_num_sub_devices());
+        devices.resize(num_tasks);
+        costs.resize(num_tasks);
+        for (size_t i = 0; i < num_tasks; i++)
+        {
+            Device *device = machine->get_device(graph.devices[i]->index);
+            assert(device->type == graph.devices[i]->type);
+            devices[i] = device;
+            costs[i] = device->type == Device::DEVICE_COMM ? to_simtime(((CommTask *)graph.tasks[i])->cost(machine))
+                                                            : graph.costs[i];
+        }
+    }
+    ready_times.assign(num_tasks, 0);
+    counters = graph.num_prev_tasks;
+    cur_sub_devices.assign(machine->get_num_devices(), 0);
+    int num_sub_devices = machine->get_num_sub_devices();
+    sub_device_times.assign(num_sub_devices, 0);
+    sub_device_busy_times.assign(num_sub_devices, 0);
+    sub_device_num_tasks.assign(num_sub_devices, 0);
+    // all the keys are 0, so the sub-devices in the order of their ids make valid heaps
+    sub_device_heap.resize(num_sub_devices);
+    heap_positions.resize(num_sub_devices);
+    for (int i = 0; i < num_sub_devices; i++)
+    {
+        sub_device_heap[i] = machine->get_sub_device(i)->sub_device_id;
+        heap_positions[i] = sub_device_heap[i];
+    }
+}
+
+SubDevice *RunState::get_avail_sub_device(Device const *device)
+{
+    if (device->max_sub_device == 1)
+    {
+        return device->sub_devices[0];
+    }
+    if (device->sub_device_policy != Device::ROUND_ROBIN)
+    {
+        return device->sub_devices[sub_device_heap[device->sub_devices[0]->index]];
+    }
+    int &cur_sub_device = cur_sub_devices[device->index];
+    SubDevice *ret = device->sub_devices[cur_sub_device++];
+    if (cur_sub_device == device->max_sub_device)
+    {
+        cur_sub_device = 0;
+    }
+    return ret;
+}
+
+void RunState::update_sub_device(SubDevice const *sub_device)
+{
+    Device const *device = sub_device->main_device;
+    if (device->max_sub_device == 1 or device->sub_device_policy == Device::ROUND_ROBIN)
+    {
+        return;
+    }
+    int base = device->sub_devices[0]->index;
+    int *heap = &sub_device_heap[base];
+    int *positions = &heap_positions[base];
+    std::vector<simtime_t> const &keys =
+        device->sub_device_policy == Device::EARLIEST_FREE ? sub_device_times : sub_device_busy_times;
+    auto less = [&](int a, int b) {
+        return keys[base + a] < keys[base + b] or (keys[base + a] == keys[base + b] and a < b);
+    };
+    auto swap_slots = [&](int i, int j) {
+        std::swap(heap[i], heap[j]);
+        positions[heap[i]] = i;
+        positions[heap[j]] = j;
+    };
+    int n = device->max_sub_device;
+    int i = positions[sub_device->sub_device_id];
+    while (i > 0 and less(heap[i], heap[(i - 1) / 2]))
+    {
+        swap_slots(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (true)
+    {
+        int child = 2 * i + 1;
+        if (child >= n)
+        {
+            break;
+        }
+        if (child + 1 < n and less(heap[child + 1], heap[child]))
+        {
+            child++;
+        }
+        if (!less(heap[child], heap[i]))
+        {
+            break;
+        }
+        swap_slots(i, child);
+        i = child;
+    }
+}
+
+// class ReadyQueue
+ReadyQueue *ReadyQueue::create(QueueType type)
+{
+    switch (type)
+    {
+    case HEAP_QUEUE:
+        return new HeapReadyQueue();
+    case CALENDAR_QUEUE:
+        return new CalendarReadyQueue();
+    case RADIX_QUEUE:
+        return new RadixReadyQueue();
+    default:
+        printf("ReadyQueue: unknown queue type %d\n", type);
+        assert(false);
+    }
+    return nullptr;
+}
+
+// class HeapReadyQueue
+void HeapReadyQueue::push(ReadyTask const &task)
+{
+    queue.push(task);
+    count_push(queue.size());
+}
+
+ReadyTask HeapReadyQueue::pop()
+{
+    ReadyTask ret = queue.top();
+    queue.pop();
+    stats.num_pops++;
+    return ret;
+}
+
+ReadyTask const &HeapReadyQueue::top()
+{
+    return queue.top();
+}
+
+bool HeapReadyQueue::empty() const
+{
+    return queue.empty();
+}
+
+size_t HeapReadyQueue::size() const
+{
+    return queue.size();
+}
+
+// class CalendarReadyQueue
+static const size_t CALENDAR_MIN_BUCKETS = 16;
+static const size_t CALENDAR_WIDTH_SAMPLES = 25;
+
+CalendarReadyQueue::CalendarReadyQueue()
+    : buckets(CALENDAR_MIN_BUCKETS), width(1.0), cur_day(0), num_tasks(0)
+{
+}
+
+long long CalendarReadyQueue::get_day(simtime_t time) const
+{
+    return (long long)std::floor(time / width);
+}
+
+void CalendarReadyQueue::push(ReadyTask const &task)
+{
+    long long day = get_day(task.ready_time);
+    if (num_tasks == 0 or day < cur_day)
+    {
+        cur_day = day;
+    }
+    std::vector<ReadyTask> &bucket = buckets[day & (buckets.size() - 1)];
+    bucket.insert(std::upper_bound(bucket.begin(), bucket.end(), task, TaskCompare()), task);
+    num_tasks++;
+    count_push(num_tasks);
+    if (num_tasks > 2 * buckets.size())
+    {
+        resize(2 * buckets.size());
+    }
+}
+
+ReadyTask CalendarReadyQueue::pop()
+{
+    return take(find_earliest());
+}
+
+ReadyTask const &CalendarReadyQueue::top()
+{
+    return find_earliest().back();
+}
+
+// Advance the current day to the bucket holding the earliest task and return that bucket
+std::vector<ReadyTask> &CalendarReadyQueue::find_earliest()
+{
+    assert(num_tasks > 0);
+    size_t mask = buckets.size() - 1;
+    for (size_t i = 0; i < buckets.size(); i++, cur_day++)
+    {
+        std::vector<ReadyTask> &bucket = buckets[cur_day & mask];
+        if (!bucket.empty() and get_day(bucket.back().ready_time) == cur_day)
+        {
+            return bucket;
+        }
+    }
+    // Nothing within a year, jump to the earliest task directly
+    std::vector<ReadyTask> *earliest = nullptr;
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        if (!buckets[i].empty() and (earliest == nullptr or TaskCompare()(earliest->back(), buckets[i].back())))
+        {
+            earliest = &buckets[i];
+        }
+    }
+    cur_day = get_day(earliest->back().ready_time);
+    return *earliest;
+}
+
+ReadyTask CalendarReadyQueue::take(std::vector<ReadyTask> &bucket)
+{
+    ReadyTask ret = bucket.back();
+    bucket.pop_back();
+    num_tasks--;
+    stats.num_pops++;
+    if (buckets.size() > CALENDAR_MIN_BUCKETS and num_tasks < buckets.size() / 2)
+    {
+        resize(buckets.size() / 2);
+    }
+    return ret;
+}
+
+bool CalendarReadyQueue::empty() const
+{
+    return num_tasks == 0;
+}
+
+size_t CalendarReadyQueue::size() const
+{
+    return num_tasks;
+}
+
+void CalendarReadyQueue::resize(size_t num_buckets)
+{
+    vector<ReadyTask> tasks;
+    tasks.reserve(num_tasks);
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        tasks.insert(tasks.end(), buckets[i].begin(), buckets[i].end());
+    }
+    buckets.clear();
+    buckets.resize(num_buckets);
+    if (tasks.empty())
+    {
+        return;
+    }
+    // Estimate the bucket width from the average gap between the earliest tasks, ignoring gaps
+    // that are much larger than the average (Brown's heuristic)
+    size_t num_samples = std::min(tasks.size(), CALENDAR_WIDTH_SAMPLES);
+    vector<simtime_t> samples;
+    samples.reserve(tasks.size());
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        samples.push_back(tasks[i].ready_time);
+    }
+    std::nth_element(samples.begin(), samples.begin() + num_samples - 1, samples.end());
+    std::sort(samples.begin(), samples.begin() + num_samples);
+    if (num_samples > 1)
+    {
+        double avg_gap = (double)(samples[num_samples - 1] - samples[0]) / (num_samples - 1);
+        double total_gap = 0.0;
+        int num_gaps = 0;
+        for (size_t i = 1; i < num_samples; i++)
+        {
+            double gap = (double)(samples[i] - samples[i - 1]);
+            if (gap > 0 and gap <= 2 * avg_gap)
+            {
+                total_gap += gap;
+                num_gaps++;
+            }
+        }
+        if (num_gaps > 0)
+        {
+            width = 3 * total_gap / num_gaps;
+        }
+    }
+
+    size_t mask = num_buckets - 1;
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        buckets[get_day(tasks[i].ready_time) & mask].push_back(tasks[i]);
+    }
+    for (size_t i = 0; i < num_buckets; i++)
+    {
+        std::sort(buckets[i].begin(), buckets[i].end(), TaskCompare());
+    }
+    cur_day = get_day(samples[0]);
+}
+
+// class RadixReadyQueue
+RadixReadyQueue::RadixReadyQueue()
+    : last_key(0), num_tasks(0), top_bucket(-1), top_index(0)
+{
+}
+
+uint64_t RadixReadyQueue::get_key(simtime_t time)
+{
+#ifdef SIMULATOR_FLOAT_TIME
+    // the bits of a non-negative float are ordered like its value
+    uint32_t bits;
+    memcpy(&bits, &time, sizeof(bits));
+    return bits;
+#else
+    return (uint64_t)time;
+#endif
+}
+
+int RadixReadyQueue::get_bucket(uint64_t key) const
+{
+    return key == last_key ? 0 : 64 - __builtin_clzll(key ^ last_key);
+}
+
+void RadixReadyQueue::push(ReadyTask const &task)
+{
+    uint64_t key = get_key(task.ready_time);
+    if (num_tasks == 0)
+    {
+        last_key = 0;
+    }
+    assert(key >= last_key);
+    int bucket = get_bucket(key);
+    buckets[bucket].push_back(task);
+    if (bucket == 0)
+    {
+        std::push_heap(buckets[0].begin(), buckets[0].end(), TaskCompare());
+    }
+    else if (top_bucket >= 0 and TaskCompare()(buckets[top_bucket][top_index], task))
+    {
+        top_bucket = bucket;
+        top_index = buckets[bucket].size() - 1;
+    }
+    num_tasks++;
+    count_push(num_tasks);
+}
+
+ReadyTask RadixReadyQueue::pop()
+{
+    assert(num_tasks > 0);
+    if (buckets[0].empty())
+    {
+        refill();
+    }
+    ReadyTask ret = buckets[0].front();
+    std::pop_heap(buckets[0].begin(), buckets[0].end(), TaskCompare());
+    buckets[0].pop_back();
+    num_tasks--;
+    stats.num_pops++;
+    return ret;
+}
+
+ReadyTask const &RadixReadyQueue::top()
+{
+    assert(num_tasks > 0);
+    if (!buckets[0].empty())
+    {
+        return buckets[0].front();
+    }
+    if (top_bucket < 0)
+    {
+        top_bucket = 1;
+        while (buckets[top_bucket].empty())
+        {
+            top_bucket++;
+        }
+        std::vector<ReadyTask> &bucket = buckets[top_bucket];
+        top_index = 0;
+        for (size_t i = 1; i < bucket.size(); i++)
+        {
+            if (TaskCompare()(bucket[top_index], bucket[i]))
+            {
+                top_index = i;
+            }
+        }
+    }
+    return buckets[top_bucket][top_index];
+}
+
+bool RadixReadyQueue::empty() const
+{
+    return num_tasks == 0;
+}
+
+size_t RadixReadyQueue::size() const
+{
+    return num_tasks;
+}
+
+void RadixReadyQueue::refill()
+{
+    int i = 1;
+    while (buckets[i].empty())
+    {
+        i++;
+    }
+    std::vector<ReadyTask> &bucket = buckets[i];
+    uint64_t min_key = get_key(bucket[0].ready_time);
+    for (size_t j = 1; j < bucket.size(); j++)
+    {
+        min_key = std::min(min_key, get_key(bucket[j].ready_time));
+    }
+    // every task of the bucket shares the bits above bit i - 1 with min_key and differs from it
+    // below, so it moves to a bucket lower than i
+    last_key = min_key;
+    for (size_t j = 0; j < bucket.size(); j++)
+    {
+        buckets[get_bucket(get_key(bucket[j].ready_time))].push_back(bucket[j]);
+    }
+    bucket.clear();
+    std::make_heap(buckets[0].begin(), buckets[0].end(), TaskCompare());
+    top_bucket = -1;
+}
+
+// class Arena
+Arena::Arena(size_t block_size)
+    : block_size(block_size), cur_block(0), cur(nullptr), end(nullptr)
+{
+}
+
+Arena::~Arena()
+{
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        free(blocks[i].first);
+    }
+}
+
+void *Arena::allocate(size_t size, size_t align)
+{
+    char *ret = (char *)(((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1));
+    while (cur == nullptr or ret + size > end)
+    {
+        // move on to the next block, allocating it if it does not exist or is too small
+        if (cur != nullptr)
+        {
+            cur_block++;
+        }
+        if (cur_block == blocks.size() or blocks[cur_block].second < size + align)
+        {
+            size_t new_size = max(block_size, size + align);
+            blocks.insert(blocks.begin() + cur_block, {(char *)malloc(new_size), new_size});
+        }
+        cur = blocks[cur_block].first;
+        end = cur + blocks[cur_block].second;
+        ret = (char *)(((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1));
+    }
+    cur = ret + size;
+    return ret;
+}
+
+void Arena::reset()
+{
+    cur_block = 0;
+    cur = nullptr;
+    end = nullptr;
+}
+
+size_t Arena::bytes_reserved() const
+{
+    size_t ret = 0;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        ret += blocks[i].second;
+    }
+    return ret;
 }
 
 // class Simulator
-Simulator::Simulator(MachineModel *machine) : machine(machine)
+Simulator::Simulator(MachineModel *machine, ReadyQueue::QueueType queue_type)
+    : comp_tasks(&arena), comm_tasks(&arena), queue_type(queue_type), ready_queue(ReadyQueue::create(queue_type)),
+      trace_sink(&null_trace_sink), profile(nullptr), engine(SEQUENTIAL_ENGINE), num_threads(1), measure_main_loop(false),
+      print_summary(true), fold_tolerance(0), flow_model(false), macro_transfers(false), rng(0),
+      incremental(false), machine(machine), sim_time(0), total_comp_time(0),
+      total_comm_time(0), total_simulated_comp_tasks(0), num_iterations(0), num_simulated_iterations(0),
+      iteration_time(0), fold_error_bound(0)
+{
+    graph.machine = machine;
+}
+
+Simulator::~Simulator()
+{
+    delete ready_queue;
+}
+
+void Simulator::reset()
+{
+    comp_tasks.clear();
+    comm_tasks.clear();
+    arena.reset();
+    interned.clear();
+    graph.clear();
+}
+
+string const *Simulator::intern(string const &text)
 {
+    return &*interned.insert(text).first;
 }
 
 Task *Simulator::new_comp_task(string name, CompDevice *comp_device, float run_time, MemDevice *mem_device)
 {
-    Task *cur_task = (Task *)new CompTask(name, comp_device, run_time, mem_device);
+    return new_comp_task(TaskName(intern(name)), comp_device, run_time, mem_device);
+}
+
+Task *Simulator::new_comp_task(TaskName name, CompDevice *comp_device, float run_time, MemDevice *mem_device)
+{
+    Task *cur_task = (Task *)comp_tasks.create(name, comp_device, run_time, mem_device);
+    cur_task->id = graph.add_task(cur_task, cur_task->cost());
     return cur_task;
 }
 
 void Simulator::new_comm_task(Task *src_task, Task *tar_task, size_t message_size)
 {
-    vector<CommDevice *> path = machine->get_comm_path(((CompTask *)src_task)->mem, ((CompTask *)tar_task)->mem);
+    CommPath path = machine->get_comm_path(((CompTask *)src_task)->mem, ((CompTask *)tar_task)->mem);
+    if (message_size > 0)
+    {
+        graph.messages.push_back({src_task->id, tar_task->id, !path.empty(), message_size});
+    }
     if (path.empty() or message_size == 0)
     {
         add_dependency(src_task, tar_task);
         return;
     }
+    if (flow_model)
+    {
+        // the flow model shares the links between the messages, so they are not segmented
+        CommTask *cur_task = comm_tasks.create(TaskName(TaskName::FLOW, src_task, tar_task), path[0], message_size);
+        cur_task->path.assign(path.begin(), path.end());
+        cur_task->id = graph.add_task(cur_task, cur_task->cost());
+        add_dependency(src_task, cur_task);
+        add_dependency(cur_task, tar_task);
+        return;
+    }
     assert(message_size > 0);
     vector<vector<Task *> > all_tasks;
     // Limit the max number of segments per message
@@ -151,6 +826,18 @@ void Simulator::new_comm_task(Task *src_task, Task *tar_task, size_t message_siz
         num_segment = 1;
         seg_size = message_size;
     }
+    if (macro_transfers and num_segment * path.size() > 1)
+    {
+        // one task for all the segments, the simulation splits it if another transfer contends with it
+        CommTask *cur_task = comm_tasks.create(TaskName(TaskName::TRANSFER, src_task, tar_task), path[0], message_size);
+        cur_task->path.assign(path.begin(), path.end());
+        cur_task->num_segments = num_segment;
+        cur_task->segment_size = seg_size;
+        cur_task->id = graph.add_task(cur_task, cur_task->cost());
+        add_dependency(src_task, cur_task);
+        add_dependency(cur_task, tar_task);
+        return;
+    }
     // Create all the comm tasks
     // Divide messages into segments
     for (int i = 0; i < path.size(); i++)
@@ -163,8 +850,8 @@ void Simulator::new_comm_task(Task *src_task, Task *tar_task, size_t message_siz
             {
                 cur_seg_size = message_size - (num_segment - 1) * seg_size;
             }
-            string name = "seg " + to_string(j) + " from " + src_task->name + " to " + tar_task->name;
-            Task *cur_task = (Task *)new CommTask(name, path[i], cur_seg_size);
+            Task *cur_task = (Task *)comm_tasks.create(TaskName(TaskName::SEGMENT, src_task, tar_task, j), path[i], cur_seg_size);
+            cur_task->id = graph.add_task(cur_task, cur_task->cost());
             all_tasks[i].push_back(cur_task);
         }
     }
@@ -209,88 +896,340 @@ void Simulator::new_comm_task(Task *src_task, Task *tar_task, size_t message_siz
 
 void Simulator::enter_ready_queue(Task *task)
 {
-    ready_queue.push(task);
+    graph.start_tasks.push_back(task->id);
 }
 
 void Simulator::add_dependency(vector<Task *> prev_tasks, Task *cur_task)
 {
     for (int i = 0; i < prev_tasks.size(); i++)
     {
-        prev_tasks[i]->add_next_task(cur_task);
+        graph.add_edge(prev_tasks[i]->id, cur_task->id);
     }
 }
 
 void Simulator::add_dependency(Task *prev_task, Task *cur_task)
 {
-    prev_task->add_next_task(cur_task);
+    graph.add_edge(prev_task->id, cur_task->id);
+}
+
+void Simulator::set_trace_sink(TraceSink *sink)
+{
+    trace_sink = sink != nullptr ? sink : &null_trace_sink;
+}
+
+void Simulator::set_profile(Profile *profile)
+{
+    this->profile = profile;
+}
+
+Profile *Simulator::get_profile() const
+{
+    return profile;
+}
+
+void Simulator::set_engine(Engine engine, int num_threads)
+{
+    this->engine = engine;
+    this->num_threads = num_threads;
+}
+
+void Simulator::set_print_summary(bool print_summary)
+{
+    this->print_summary = print_summary;
+}
+
+void Simulator::set_seed(uint64_t seed)
+{
+    rng.seed(seed);
+}
+
+std::mt19937_64 &Simulator::get_rng()
+{
+    return rng;
+}
+
+void Simulator::set_flow_model(bool flow_model)
+{
+    this->flow_model = flow_model;
+}
+
+void Simulator::set_macro_transfers(bool macro_transfers)
+{
+    this->macro_transfers = macro_transfers;
+}
+
+void Simulator::set_iteration_folding(double tolerance)
+{
+    fold_tolerance = tolerance;
 }
 
 void Simulator::simulate()
 {
-    srand(time(NULL));
-    bool measure_main_loop = false;
-    float main_loop_start = std::numeric_limits<float>::max();
-    float main_loop_stop = 0.0f;
-    float sim_time = 0.0f;
-    float comp_time = 0.0f;
-    int comp_count = 0;
-    float comm_time = 0.0f;
-    unordered_map<SubDevice *, float> device_times;
-    while (!ready_queue.empty())
+    ProfilePhase phase(profile, "finalize_graph");
+    graph.finalize();
+    phase.stop();
+    if (fold_tolerance > 0 and !incremental)
+    {
+        simulate_folded(graph);
+        return;
+    }
+    simulate(graph);
+}
+
+void Simulator::simulate(TaskGraph const &graph)
+{
+    ProfilePhase phase(profile, "simulate");
+    main_loop_start = SIMTIME_MAX;
+    main_loop_stop = 0;
+    sim_time = 0;
+    total_comp_time = 0;
+    total_simulated_comp_tasks = 0;
+    total_comm_time = 0;
+    run.init(graph, machine);
+    trace_sink->begin(graph);
+    if (incremental)
+    {
+        schedule.init(graph);
+    }
+    bool simulated = false;
+    if (flow_model)
+    {
+        assert(!incremental);
+        simulate_flows(graph);
+        simulated = true;
+    }
+    else if (macro_transfers)
+    {
+        assert(!incremental);
+        simulate_pipelined(graph);
+        simulated = true;
+    }
+    else if (engine == CONSERVATIVE_ENGINE)
+    {
+        simulated = simulate_conservative(graph);
+    }
+    else if (engine == OPTIMISTIC_ENGINE)
+    {
+        simulated = simulate_optimistic(graph);
+    }
+    if (!simulated)
+    {
+        simulate_sequential(graph);
+    }
+    if (incremental)
+    {
+        schedule.finish(machine);
+    }
+    trace_sink->flush();
+    phase.stop();
+    if (profile != nullptr)
+    {
+        uint64_t num_events = 0;
+        for (size_t i = 0; i < run.sub_device_num_tasks.size(); i++)
+        {
+            num_events += run.sub_device_num_tasks[i];
+        }
+        profile->add_count("simulations", 1);
+        profile->add_count("events", num_events);
+        profile->add_queue_stats(ready_queue->stats);
+        ready_queue->stats = ReadyQueue::Stats();
+        profile->set_max("tasks", graph.num_tasks());
+        profile->set_max("edges", graph.next_tasks.size());
+        profile->set_max("arena_bytes", arena.bytes_reserved());
+        profile->set_max("graph_bytes", graph.bytes_reserved());
+    }
+    if (!print_summary)
+    {
+        return;
+    }
+    if (measure_main_loop)
+    {
+        cout << "main_loop " << to_ms(main_loop_stop - main_loop_start) << "ms" << endl;
+    }
+    print_totals();
+}
+
+void Simulator::print_totals() const
+{
+    cout << "sim_time " << to_ms(sim_time) << "ms" << endl;
+    cout << "total_simulated_comp_tasks " << total_simulated_comp_tasks << endl;
+    cout << "total_comp_time " << to_ms(total_comp_time) << "ms" << endl;
+    cout << "total_comm_time " << to_ms(total_comm_time) << "ms" << endl;
+}
+
+void Simulator::simulate_sequential(TaskGraph const &graph)
+{
+    for (size_t i = 0; i < graph.start_tasks.size(); i++)
+    {
+        ready_queue->push({0, graph.start_tasks[i]});
+    }
+    process_ready_queue(graph);
+}
+
+void Simulator::process_ready_queue(TaskGraph const &graph)
+{
+    while (!ready_queue->empty())
     {
         // Find the task with the earliest start time
-        Task *cur_task = ready_queue.top();
-        ready_queue.pop();
-        float ready_time = 0;
-        SubDevice *cur_sub_device = cur_task->device->get_avail_sub_device();
-        if (device_times.find(cur_sub_device) != device_times.end())
+        task_id_t cur_task = ready_queue->pop().id;
+        SubDevice *cur_sub_device = run.get_avail_sub_device(run.devices[cur_task]);
+        simtime_t ready_time = run.sub_device_times[cur_sub_device->index];
+        simtime_t start_time = max(ready_time, run.ready_times[cur_task]);
+        simtime_t run_time = run.costs[cur_task];
+        simtime_t end_time = start_time + run_time;
+        run.sub_device_times[cur_sub_device->index] = end_time;
+        run.sub_device_busy_times[cur_sub_device->index] += run_time;
+        run.sub_device_num_tasks[cur_sub_device->index]++;
+        run.update_sub_device(cur_sub_device);
+        account(graph, cur_task, cur_sub_device, run.ready_times[cur_task], ready_time, start_time, run_time, end_time);
+        for (uint32_t i = graph.next_offsets[cur_task]; i < graph.next_offsets[cur_task + 1]; i++)
         {
-            ready_time = device_times[cur_sub_device];
+            task_id_t next = graph.next_tasks[i];
+            run.ready_times[next] = max(run.ready_times[next], end_time);
+            run.counters[next]--;
+            if (run.counters[next] == 0)
+            {
+                ready_queue->push({run.ready_times[next], next});
+            }
         }
-        float start_time = max(ready_time, cur_task->ready_time);
-        float run_time = 0;
-        if (cur_task->device->type == Device::DEVICE_COMP)
+    }
+}
+
+void Simulator::simulate_flows(TaskGraph const &graph)
+{
+    flows.init(machine);
+    vector<CommDevice *> links;
+    // the links of a communication task on the simulated machine model
+    auto get_links = [&](task_id_t task) {
+        CommTask const *comm_task = (CommTask const *)graph.tasks[task];
+        links.clear();
+        if (comm_task->path.empty())
         {
-            run_time = ((CompTask *)cur_task)->cost();
-            comp_time += run_time;
-            comp_count++;
+            links.push_back((CommDevice *)run.devices[task]);
         }
-        else
+        for (size_t i = 0; i < comm_task->path.size(); i++)
+        {
+            links.push_back((CommDevice *)machine->get_device(comm_task->path[i]->index));
+        }
+        return comm_task->message_size;
+    };
+    for (size_t i = 0; i < graph.start_tasks.size(); i++)
+    {
+        ready_queue->push({0, graph.start_tasks[i]});
+    }
+    while (!ready_queue->empty() or flows.num_active() > 0)
+    {
+        task_id_t cur_task;
+        SubDevice *cur_sub_device;
+        simtime_t ready_time, start_time, run_time, end_time;
+        if (ready_queue->empty() or flows.finishes_before(ready_queue->top().ready_time))
         {
-            run_time = ((CommTask *)cur_task)->cost();
-            comm_time += run_time;
+            // the last byte of a flow arrives, the message after the latencies of its links
+            simtime_t finish_time = flows.next_finish_time();
+            cur_task = flows.finish();
+            size_t message_size = get_links(cur_task);
+            float latency = 0;
+            for (size_t i = 0; i < links.size(); i++)
+            {
+                latency += links[i]->latency;
+                SubDevice *link = links[i]->sub_devices[0];
+                run.sub_device_busy_times[link->index] += to_simtime(message_size / links[i]->bandwidth);
+                run.sub_device_num_tasks[link->index]++;
+            }
+            cur_sub_device = links[0]->sub_devices[0];
+            ready_time = start_time = run.ready_times[cur_task];
+            end_time = finish_time + to_simtime(latency);
+            run_time = end_time - start_time;
         }
-        float end_time = start_time + run_time;
-        device_times[cur_sub_device] = end_time;
-        if (measure_main_loop and cur_task->is_main)
+        else
         {
-            main_loop_start = fminf(main_loop_start, start_time);
-            main_loop_stop = fmaxf(main_loop_stop, end_time);
+            cur_task = ready_queue->pop().id;
+            if (run.devices[cur_task]->type == Device::DEVICE_COMM)
+            {
+                size_t message_size = get_links(cur_task);
+                flows.start(cur_task, links, message_size, run.ready_times[cur_task]);
+                continue;
+            }
+            cur_sub_device = run.get_avail_sub_device(run.devices[cur_task]);
+            ready_time = run.sub_device_times[cur_sub_device->index];
+            start_time = max(ready_time, run.ready_times[cur_task]);
+            run_time = run.costs[cur_task];
+            end_time = start_time + run_time;
+            run.sub_device_times[cur_sub_device->index] = end_time;
+            run.sub_device_busy_times[cur_sub_device->index] += run_time;
+            run.sub_device_num_tasks[cur_sub_device->index]++;
+            run.update_sub_device(cur_sub_device);
         }
-        // if (cur_task->device->name == "GPU 4")
-        //  if (run_time < 0)
-        cout << cur_task->name << " --- " << cur_task->device->name << " --- "
-             << "task_ready(" << cur_task->ready_time << ") device_ready(" << ready_time << ") start(" << start_time << ") run(" << run_time << ") end(" << end_time << ")" << endl;
-        if (end_time > sim_time)
-            sim_time = end_time;
-        for (size_t i = 0; i < cur_task->next_tasks.size(); i++)
+        account(graph, cur_task, cur_sub_device, run.ready_times[cur_task], ready_time, start_time, run_time, end_time);
+        for (uint32_t i = graph.next_offsets[cur_task]; i < graph.next_offsets[cur_task + 1]; i++)
         {
-            Task *next = cur_task->next_tasks[i];
-            next->ready_time = max(next->ready_time, end_time);
-            next->counter--;
-            if (next->counter == 0)
+            task_id_t next = graph.next_tasks[i];
+            run.ready_times[next] = max(run.ready_times[next], end_time);
+            run.counters[next]--;
+            if (run.counters[next] == 0)
             {
-                ready_queue.push(next);
+                ready_queue->push({run.ready_times[next], next});
             }
         }
     }
-    if (measure_main_loop)
+    if (profile != nullptr)
+    {
+        profile->set_max("peak_flows", flows.peak_flows);
+    }
+}
+
+void Simulator::account(TaskGraph const &graph, task_id_t task, SubDevice *sub_device, simtime_t task_ready_time,
+                        simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time)
+{
+    if (run.devices[task]->type == Device::DEVICE_COMP)
     {
-        cout << "main_loop " << main_loop_stop - main_loop_start << "ms" << endl;
+        total_comp_time += run_time;
+        total_simulated_comp_tasks++;
+    }
+    else
+    {
+        total_comm_time += run_time;
+    }
+    if (measure_main_loop and graph.tasks[task]->is_main)
+    {
+        main_loop_start = std::min(main_loop_start, start_time);
+        main_loop_stop = max(main_loop_stop, end_time);
+    }
+    trace_sink->record(graph.tasks[task], sub_device, task_ready_time, device_ready_time, start_time, run_time,
+                       end_time);
+    if (incremental)
+    {
+        schedule.record(task, sub_device, task_ready_time, start_time, run_time, end_time);
+    }
+    if (end_time > sim_time)
+        sim_time = end_time;
+}
+
+void Simulator::print_device_stats() const
+{
+    for (int i = 0; i < machine->get_num_devices(); i++)
+    {
+        Device *device = machine->get_device(i);
+        simtime_t busy_time = 0;
+        int num_tasks = 0;
+        for (size_t j = 0; j < device->sub_devices.size(); j++)
+        {
+            busy_time += run.sub_device_busy_times[device->sub_devices[j]->index];
+            num_tasks += run.sub_device_num_tasks[device->sub_devices[j]->index];
+        }
+        if (num_tasks == 0)
+        {
+            continue;
+        }
+        cout << "device " << device->name << " tasks " << num_tasks << " busy " << to_ms(busy_time) << "ms utilization "
+             << (sim_time > 0 ? to_ms(busy_time) / (to_ms(sim_time) * device->sub_devices.size()) : 0.0) << endl;
+        // the streams of a GPU, or the sub-devices of another device
+        for (size_t j = 0; device->sub_devices.size() > 1 and j < device->sub_devices.size(); j++)
+        {
+            int index = device->sub_devices[j]->index;
+            cout << "sub_device " << device->name << " " << j << " tasks " << run.sub_device_num_tasks[index]
+                 << " busy " << to_ms(run.sub_device_busy_times[index]) << "ms utilization "
+                 << (sim_time > 0 ? to_ms(run.sub_device_busy_times[index]) / to_ms(sim_time) : 0.0) << endl;
+        }
     }
-    cout << "sim_time " << sim_time << "ms" << endl;
-    cout << "total_simulated_comp_tasks " << comp_count << endl;
-    cout << "total_comp_time " << comp_time << "ms" << endl;
-    cout << "total_comm_time " << comm_time << "ms" << endl;
-    return;
 }
@@ -1,8 +1,20 @@
 #include <iostream>
+#include <sstream>
+#include <fstream>
 #include <vector>
 #include <queue>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <cstdint>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <new>
+#include <random>
+#include <utility>
+#include <tuple>
+#include <type_traits>
 #include <time.h>
 #include <boost/functional/hash.hpp>
 
@@ -17,16 +29,24 @@ public:
         DEVICE_MEM,
         DEVICE_COMM,
     };
+    // how a task picks one of the sub-devices of its device, e.g. a CUDA stream of a GPU
+    enum SubDevicePolicy
+    {
+        ROUND_ROBIN,
+        EARLIEST_FREE, // the sub-device that becomes available first
+        LEAST_LOADED,  // the sub-device with the least busy time so far
+    };
     Device(std::string name, DeviceType type, int node_id, int socket_id, int device_id, int max_sub_device);
+    virtual ~Device();
     std::string name;
     DeviceType type;
+    int index; // dense index among all the devices of the machine model
     int node_id;
     int socket_id;
     int device_id;
     int max_sub_device;
-    int cur_sub_deivce;
+    SubDevicePolicy sub_device_policy; // ROUND_ROBIN unless the machine model sets another one
     std::vector<SubDevice *> sub_devices;
-    SubDevice *get_avail_sub_device();
 };
 
 class SubDevice
@@ -34,6 +54,7 @@ class SubDevice
 public:
     Device *main_device;
     int sub_device_id; // from 0 to max_sub_device - 1 for each device
+    int index;         // dense index among all the sub-devices of the machine model
     SubDevice(Device *main_device, int sub_device_id);
 };
 
@@ -65,6 +86,8 @@ public:
         GPU_FB_MEM, // GPU framebuffer memory for a single GPU
     };
     MemDevType mem_type;
+    int mem_index; // dense index among the memories of the machine model
+    size_t capacity; // in bytes, 0 if unlimited
     MemDevice(std::string name, MemDevType mem_type, int node_id, int socket_id, int device_id);
 };
 
@@ -88,10 +111,28 @@ public:
     CommDevice(std::string name, CommDevType comm_type, int node_id, int socket_id, int device_id, float latency, float bandwidth);
 };
 
+// A view of the comm devices of a route, which the machine model keeps
+class CommPath
+{
+public:
+    CommPath() : first(nullptr), num_devices(0) {}
+    CommPath(CommDevice *const *first, size_t num_devices) : first(first), num_devices(num_devices) {}
+    CommDevice *const *begin() const { return first; }
+    CommDevice *const *end() const { return first + num_devices; }
+    size_t size() const { return num_devices; }
+    bool empty() const { return num_devices == 0; }
+    CommDevice *operator[](size_t i) const { return first[i]; }
+
+private:
+    CommDevice *const *first;
+    size_t num_devices;
+};
+
 class MachineModel
 {
 public:
-    virtual ~MachineModel() = default;
+    MachineModel();
+    virtual ~MachineModel();
     virtual int get_version() const = 0;
     virtual CompDevice *get_cpu(int device_id) const = 0;
     virtual CompDevice *get_cpu(int socket_id, int local_id) const = 0;
@@ -101,16 +142,76 @@ public:
     virtual int get_num_gpus() const = 0;
     virtual float get_intra_node_gpu_bandwidth() const = 0;
     virtual float get_inter_node_gpu_bandwidth() const = 0;
-    virtual std::vector<CommDevice *> get_comm_path(MemDevice *src_mem, MemDevice *tar_mem) = 0;
+    // The route between two memories. A route is found once, the first time it is asked for, and
+    // is then only looked up in a table by the memories: the path is a view of it and stays valid
+    // as long as the machine model. A route through links chosen round robin has one choice
+    // per position of the round robin, and the calls take the choices in the order find_comm_path()
+    // would.
+    CommPath get_comm_path(MemDevice *src_mem, MemDevice *tar_mem);
+    // the route get_comm_path() would return, without taking a choice of the round robin
+    CommPath peek_comm_path(MemDevice *src_mem, MemDevice *tar_mem);
+    // restart the round robin of the routes, the next ones take the links a new machine model would
+    void restart_round_robin();
     virtual std::string to_string() const = 0;
     virtual int get_num_nodes() const = 0;
     virtual int get_num_sockets_per_node() const = 0;
     virtual int get_num_cpus_per_socket() const = 0;
     virtual int get_num_gpus_per_socket() const = 0;
+    int get_num_devices() const;
+    int get_num_sub_devices() const;
+    Device *get_device(int index) const;
+    SubDevice *get_sub_device(int index) const;
     int version;
     size_t default_seg_size;
     int max_num_segs;
     float realm_comm_overhead;
+
+protected:
+    // take the ownership of a device created by the machine model, and give the device and its
+    // sub-devices their dense indices
+    template <typename T>
+    T *add_device(T *device)
+    {
+        device->index = devices.size();
+        devices.push_back(device);
+        for (size_t i = 0; i < device->sub_devices.size(); i++)
+        {
+            device->sub_devices[i]->index = sub_devices.size();
+            sub_devices.push_back(device->sub_devices[i]);
+        }
+        index_memory(device);
+        return device;
+    }
+    // the links of the route between two memories, taking the links chosen round robin at
+    // route_choice, which it advances
+    virtual void find_comm_path(MemDevice *src_mem, MemDevice *tar_mem, std::vector<CommDevice *> &ret) = 0;
+    int num_route_choices; // positions of the round robin of the links, 1 without one
+    int route_choice;      // current position of the round robin
+
+private:
+    // A route found by find_comm_path(), with the devices of all its choices one after the other
+    // in route_devices[index]
+    struct Route
+    {
+        uint32_t index;
+        uint16_t length;
+        uint16_t num_choices; // 1 when the route takes no link chosen round robin, 0 until it is found
+        int num_steps;        // how far taking the route advances the round robin
+    };
+    void index_memory(Device *device) {}
+    void index_memory(MemDevice *mem)
+    {
+        mem->mem_index = mems.size();
+        mems.push_back(mem);
+    }
+    // the route between two memories, found the first time it is asked for
+    Route const &lookup_route(MemDevice *src_mem, MemDevice *tar_mem);
+    void find_route(MemDevice *src_mem, MemDevice *tar_mem, Route &route);
+    std::vector<Device *> devices;
+    std::vector<SubDevice *> sub_devices;
+    std::vector<MemDevice *> mems; // by MemDevice::mem_index
+    std::vector<Route> routes;     // by the mem_index of the source and of the target
+    std::vector<std::vector<CommDevice *> > route_devices;
 };
 
 class SimpleMachineModel : public MachineModel
@@ -127,13 +228,15 @@ public:
     int get_num_gpus() const;
     float get_intra_node_gpu_bandwidth() const;
     float get_inter_node_gpu_bandwidth() const;
-    std::vector<CommDevice *> get_comm_path(MemDevice *src_mem, MemDevice *tar_mem);
     std::string to_string() const;
     int get_num_nodes() const;
     int get_num_sockets_per_node() const;
     int get_num_cpus_per_socket() const;
     int get_num_gpus_per_socket() const;
 
+protected:
+    void find_comm_path(MemDevice *src_mem, MemDevice *tar_mem, std::vector<CommDevice *> &ret);
+
 private:
     int num_nodes;
     int num_cpus_per_node;
@@ -168,7 +271,8 @@ private:
 class EnhancedMachineModel : public MachineModel
 {
 public:
-    EnhancedMachineModel(std::string file);
+    // the overrides replace the values of the keys of the config file
+    EnhancedMachineModel(std::string file, std::unordered_map<std::string, std::string> const &overrides = {});
     ~EnhancedMachineModel();
     int get_version() const;
     CompDevice *get_cpu(int device_id) const;
@@ -187,19 +291,22 @@ public:
     int get_num_gpus() const;
     float get_intra_node_gpu_bandwidth() const;
     float get_inter_node_gpu_bandwidth() const;
-    std::vector<CommDevice *> get_comm_path(MemDevice *src_mem, MemDevice *tar_mem);
     std::string to_string() const;
     int get_num_nodes() const;
     int get_num_sockets_per_node() const;
     int get_num_cpus_per_socket() const;
     int get_num_gpus_per_socket() const;
 
+protected:
+    void find_comm_path(MemDevice *src_mem, MemDevice *tar_mem, std::vector<CommDevice *> &ret);
+
 private:
     int num_nodes;
     int num_sockets_per_node;
     int num_cpus_per_socket;
     int num_gpus_per_socket;
     int num_cudastream_per_gpu = 1;
+    Device::SubDevicePolicy cudastream_policy = Device::ROUND_ROBIN;
     int num_sockets;
     int num_cpus;
     int num_gpus;
@@ -211,13 +318,16 @@ private:
     float nic_latency;
     float nic_bandwidth;
     int nic_persocket;
-    int cur_nic_local_id;
     float pci_latency;
     float pci_bandwidth;
     int pci_persocket = 1;
     float nvlink_latency;
     float nvlink_bandwidth;
     int nvlink_version = 1;
+    // capacities of the memories in bytes, 0 if unlimited
+    size_t sys_mem_capacity = 0;
+    size_t z_copy_mem_capacity = 0;
+    size_t gpu_fb_mem_capacity = 0;
     std::vector<CommDevice::CommDevType> intra_socket_sys_mem_to_sys_mem;
     std::vector<CommDevice::CommDevType> inter_socket_sys_mem_to_sys_mem;
     std::vector<CommDevice::CommDevType> inter_node_sys_mem_to_sys_mem;
@@ -259,19 +369,94 @@ private:
     void add_comm_path(std::vector<CommDevice::CommDevType> const &comm_device_list, MemDevice *src_mem, MemDevice *tar_mem, std::vector<CommDevice *> &ret);
 };
 
+typedef uint32_t task_id_t;
+
+// Simulated time. The engines use integer nanoseconds, so sums of costs are exact and ties stay
+// ties however long the simulation runs. The machine model and the task costs are in float
+// milliseconds and are converted with to_simtime() when the task graph is built; to_ms() converts
+// the results back. Building with SIMULATOR_FLOAT_TIME switches back to float milliseconds, to
+// compare with the results of the earlier versions.
+#ifdef SIMULATOR_FLOAT_TIME
+typedef float simtime_t;
+const simtime_t SIMTIME_MAX = std::numeric_limits<float>::infinity();
+
+inline simtime_t to_simtime(double ms)
+{
+    return (simtime_t)ms;
+}
+
+inline double to_ms(simtime_t time)
+{
+    return time;
+}
+#else
+typedef int64_t simtime_t;
+const simtime_t SIMTIME_MAX = std::numeric_limits<int64_t>::max();
+
+inline simtime_t to_simtime(double ms)
+{
+    return std::llround(ms * 1e6);
+}
+
+inline double to_ms(simtime_t time)
+{
+    return time * 1e-6;
+}
+#endif
+
+class Task;
+
+/**
+ * The name of a task, kept as the parts it is made of and only formatted by to_string() when a
+ * trace prints it. The segments of the messages are most of the tasks, and building a string for
+ * each of them was a large part of the time and the memory of building the graph.
+ */
+struct TaskName
+{
+    enum NameKind : uint8_t
+    {
+        TEXT,       // the text, interned by the simulator
+        OP_NODE,    // "op_node_<number>"
+        REALM_COPY, // "realm_copy_<number>"
+        REALM_FILL, // "realm_fill_<number>"
+        SEGMENT,    // "seg <segment> from <src> to <tar>"
+        FLOW,       // "flow from <src> to <tar>"
+        TRANSFER,   // "transfer from <src> to <tar>"
+        STEP,       // "<text> step <segment>", a step of a collective
+    };
+    NameKind kind;
+    uint32_t segment;
+    union
+    {
+        std::string const *text;
+        int64_t number;
+        Task const *src;
+    };
+    Task const *tar;
+    TaskName();
+    explicit TaskName(std::string const *text);
+    TaskName(NameKind kind, int64_t number);
+    TaskName(NameKind kind, std::string const *text, uint32_t segment);
+    TaskName(NameKind kind, Task const *src, Task const *tar, uint32_t segment = 0);
+    std::string to_string() const;
+};
+
+/**
+ * A task is a handle used to build the task graph: it keeps the descriptive fields of the task
+ * (name, device, ...) and its id in the TaskGraph of the simulator, where the data used while
+ * simulating lives.
+ */
 class Task
 {
 public:
-    Task(std::string name, Device *device);
-    size_t id;
-    static size_t cur_id;
-    std::string name;
+    Task(TaskName name, Device *device);
+    task_id_t id;
+    TaskName name;
     Device *device;
-    float ready_time;
-    std::vector<Task *> next_tasks;
-    int counter;
     bool is_main; // whether is a part of main loop
-    void add_next_task(Task *task);
+    // op kind in reports, e.g. "Conv2D Forward", interned by the simulator, nullptr for the plain
+    // comp and comm tasks
+    std::string const *kind;
     virtual float cost() const = 0;
     virtual std::string to_string() const = 0;
 };
@@ -279,7 +464,7 @@ public:
 class CompTask : public Task
 {
 public:
-    CompTask(std::string name, CompDevice *comp_deivce, float run_time, MemDevice *mem_device);
+    CompTask(TaskName name, CompDevice *comp_deivce, float run_time, MemDevice *mem_device);
     MemDevice *mem;
     float run_time;
     float cost() const;
@@ -289,39 +474,863 @@ public:
 class CommTask : public Task
 {
 public:
-    CommTask(std::string name, CommDevice *comm_device, size_t message_size);
+    CommTask(TaskName name, CommDevice *comm_device, size_t message_size);
     size_t message_size;
+    // all the links of a message in the flow model, see flow_model.cc, or of a macro transfer,
+    // see macro_transfers.cc, empty for a transfer on one device
+    std::vector<CommDevice *> path;
+    // the segments of a macro transfer, 0 for a flow
+    int num_segments;
+    size_t segment_size; // of all the segments but the last one, which takes the rest
     float cost() const;
+    // the cost of the same transfer on the devices of another machine model with the same layout
+    float cost(MachineModel const *machine) const;
+    // the time of a macro transfer on free devices, see macro_transfers.cc
+    float pipelined_cost(MachineModel const *machine) const;
     std::string to_string() const;
 };
 
+// An entry of the ready queue. The ready time is copied in when the task becomes ready (it
+// does not change afterwards), so ordering the queue never has to look up the task.
+struct ReadyTask
+{
+    simtime_t ready_time;
+    task_id_t id;
+};
+
 class TaskCompare
 {
 public:
-    bool operator()(Task *lhs, Task *rhs)
+    bool operator()(ReadyTask const &lhs, ReadyTask const &rhs) const
     {
-        if (lhs->ready_time == rhs->ready_time)
+        if (lhs.ready_time == rhs.ready_time)
         {
-            return lhs->id > rhs->id;
+            return lhs.id > rhs.id;
         }
-        return lhs->ready_time > rhs->ready_time;
+        return lhs.ready_time > rhs.ready_time;
     }
 };
 
+// The queue of ready tasks. Tasks are popped in (ready_time, id) order by every implementation,
+// so the choice of queue never changes the simulation result.
+class ReadyQueue
+{
+public:
+    enum QueueType
+    {
+        HEAP_QUEUE,
+        CALENDAR_QUEUE,
+        RADIX_QUEUE,
+    };
+    // number of operations since the queue was created, for profiling
+    struct Stats
+    {
+        uint64_t num_pushes;
+        uint64_t num_pops;
+        size_t peak_size;
+    };
+    Stats stats = {};
+    virtual ~ReadyQueue() = default;
+    virtual void push(ReadyTask const &task) = 0;
+    virtual ReadyTask pop() = 0;
+    // the task that pop() would return, without removing it
+    virtual ReadyTask const &top() = 0;
+    virtual bool empty() const = 0;
+    virtual size_t size() const = 0;
+    static ReadyQueue *create(QueueType type);
+
+protected:
+    void count_push(size_t size)
+    {
+        stats.num_pushes++;
+        if (size > stats.peak_size)
+        {
+            stats.peak_size = size;
+        }
+    }
+};
+
+class HeapReadyQueue : public ReadyQueue
+{
+public:
+    void push(ReadyTask const &task);
+    ReadyTask pop();
+    ReadyTask const &top();
+    bool empty() const;
+    size_t size() const;
+
+private:
+    std::priority_queue<ReadyTask, std::vector<ReadyTask>, TaskCompare> queue;
+};
+
+/**
+ * A calendar queue (R. Brown, 1988). Ready times are quantized into buckets of `width` time units, and
+ * the buckets wrap around like the days of a year. Popping scans forward from the current day and
+ * only takes a task that falls into the current year, so push and pop are O(1) amortized when the
+ * bucket width matches the spacing of the ready times. The number of buckets doubles or halves
+ * with the queue size, and the width is re-estimated from the earliest tasks on every resize.
+ * Each bucket is kept sorted by (ready_time, id), which keeps the tie-breaking of the heap.
+ */
+class CalendarReadyQueue : public ReadyQueue
+{
+public:
+    CalendarReadyQueue();
+    void push(ReadyTask const &task);
+    ReadyTask pop();
+    ReadyTask const &top();
+    bool empty() const;
+    size_t size() const;
+
+private:
+    std::vector<std::vector<ReadyTask> > buckets; // sorted in descending order, the earliest task is at the back
+    double width;
+    long long cur_day; // index of the current bucket, counted from time 0 without wrapping around
+    size_t num_tasks;
+    long long get_day(simtime_t time) const;
+    std::vector<ReadyTask> &find_earliest();
+    ReadyTask take(std::vector<ReadyTask> &bucket);
+    void resize(size_t num_buckets);
+};
+
+/**
+ * A radix heap (Ahuja, Mehlhorn, Orlin and Tarjan, 1990). It relies on the engines never pushing a
+ * task that is ready before the last popped one: a task only enables tasks that are ready at or
+ * after its end. The ready times are compared by their bits, and bucket i > 0 holds the tasks whose
+ * ready time first differs from the last popped one at bit i - 1, so a task can only move to lower
+ * buckets and is moved at most once per bit. When bucket 0, the tasks ready at the last popped
+ * time, is empty, pop() redistributes the first non-empty bucket around its earliest task. Bucket
+ * 0 is a heap by id, which keeps the tie-breaking of the heap queue, also for the tasks that a
+ * zero-cost task enables at the current time. top() only looks for the earliest task and keeps its
+ * position, so peeking does not advance the last popped time: the conservative engine peeks past
+ * the end of its window and then pushes the tasks that other partitions enable before it.
+ */
+class RadixReadyQueue : public ReadyQueue
+{
+public:
+    RadixReadyQueue();
+    void push(ReadyTask const &task);
+    ReadyTask pop();
+    ReadyTask const &top();
+    bool empty() const;
+    size_t size() const;
+
+private:
+    static const int NUM_BUCKETS = 65;
+    std::vector<ReadyTask> buckets[NUM_BUCKETS];
+    uint64_t last_key; // bits of the last popped ready time, 0 when the queue was empty
+    size_t num_tasks;
+    // position of the earliest task when bucket 0 is empty, top_bucket is -1 if not known
+    int top_bucket;
+    size_t top_index;
+    static uint64_t get_key(simtime_t time);
+    int get_bucket(uint64_t key) const;
+    // move the tasks of the first non-empty bucket to lower buckets, when bucket 0 is empty
+    void refill();
+};
+
+/**
+ * Struct-of-arrays store of a task graph. Tasks are numbered densely in the order they are
+ * created, and the per-task data needed by Simulator::simulate() is kept in separate arrays
+ * indexed by the task id. The successors of all the tasks are stored in a single CSR array:
+ * the successors of task i are next_tasks[next_offsets[i]] to next_tasks[next_offsets[i + 1] - 1].
+ * Edges are collected in a list while the graph is built and moved into the CSR array by finalize().
+ */
+class TaskGraph
+{
+public:
+    // a message of new_comm_task(), a copy if it has to cross a path between two memories
+    struct Message
+    {
+        task_id_t src;
+        task_id_t tar;
+        bool copy;
+        uint64_t size;
+    };
+    TaskGraph();
+    void clear();
+    MachineModel *machine; // the machine model of the devices
+    std::vector<Task *> tasks; // handles of the tasks, used for names and printing
+    std::vector<Device *> devices;
+    std::vector<simtime_t> costs;
+    std::vector<int> num_prev_tasks; // initial value of the dependency counter of each task
+    std::vector<uint32_t> next_offsets;
+    std::vector<task_id_t> next_tasks;
+    std::vector<task_id_t> start_tasks; // tasks entering the ready queue when a simulation starts
+    std::vector<Message> messages; // the data sent between the tasks, for the memory report
+    size_t num_tasks() const;
+    task_id_t add_task(Task *task, float cost);
+    void add_edge(task_id_t prev_task, task_id_t next_task);
+    void finalize();
+    bool finalized() const;
+    size_t bytes_reserved() const;
+
+private:
+    std::vector<std::pair<task_id_t, task_id_t> > new_edges;
+};
+
+/**
+ * The state of one simulation of a TaskGraph. simulate() never modifies the graph, so a finished
+ * graph can be simulated any number of times, also by several simulators at the same time. All the
+ * state a simulation changes lives here and is re-initialized by init(), which reuses the memory
+ * of the previous run.
+ */
+class RunState
+{
+public:
+    // The graph may have been built on another machine model with the same devices, for example
+    // a machine config with other latencies and bandwidths. Its devices are then looked up by index
+    // and the costs of the communication tasks are recomputed on this machine model.
+    void init(TaskGraph const &graph, MachineModel *machine);
+    SubDevice *get_avail_sub_device(Device const *device);
+    // restore the order of the sub-devices of a device after the time or the busy time of one of
+    // them changed, called after every task
+    void update_sub_device(SubDevice const *sub_device);
+    std::vector<Device *> devices; // device of each task on the simulated machine model
+    std::vector<simtime_t> costs;
+    std::vector<simtime_t> ready_times;
+    std::vector<int> counters;
+    std::vector<int> cur_sub_devices;    // round-robin position of each device, indexed by Device::index
+    // Min-heaps of the sub-devices of the devices with the other policies, by the time or the busy
+    // time and then the sub-device id. The heap of a device takes the slots of its sub-devices,
+    // which have consecutive indices: sub_device_heap holds sub-device ids and heap_positions the
+    // slot of each sub-device in the heap, both indexed by SubDevice::index.
+    std::vector<int> sub_device_heap;
+    std::vector<int> heap_positions;
+    std::vector<simtime_t> sub_device_times; // when each sub-device becomes available
+    // statistics, indexed by SubDevice::index
+    std::vector<simtime_t> sub_device_busy_times;
+    std::vector<int> sub_device_num_tasks;
+};
+
+/**
+ * The schedule of a simulation: the order in which the sequential engine runs the tasks, and when
+ * and where each of them runs. Simulator::resimulate() keeps it up to date by replaying only the
+ * part of it that an edit of the costs or the devices of some tasks changes, see
+ * incremental_simulator.cc.
+ */
+class Schedule
+{
+public:
+    static const uint32_t NOT_RUN = UINT32_MAX;
+    Schedule() : graph(nullptr), epoch(0), num_unsynced_devices(0), round_robin(true) {}
+    void init(TaskGraph const &graph);
+    void record(task_id_t task, SubDevice *sub_device, simtime_t ready_time, simtime_t start_time,
+                simtime_t run_time, simtime_t end_time);
+    // index the recorded schedule by device, called when the simulation is finished
+    void finish(MachineModel *machine);
+    simtime_t get_sim_time() const;
+    void set_end_time(task_id_t task, simtime_t end_time);
+    // number of tasks a device ran before a position of the schedule
+    uint32_t recorded_count(Device const *device, uint32_t position) const;
+    // start the replay state of a device from its recorded state at the start of the replay
+    void touch_device(Device const *device, uint32_t start);
+    // compare the replay state of a device with its recorded state at the cursor of the replay
+    void check_device(Device const *device);
+    TaskGraph const *graph;
+    std::vector<task_id_t> order;
+    std::vector<uint32_t> positions; // position of each task in order, NOT_RUN if it did not run
+    std::vector<simtime_t> ready_times;
+    std::vector<simtime_t> start_times;
+    std::vector<simtime_t> run_times;
+    std::vector<simtime_t> end_times;
+    std::vector<SubDevice *> sub_devices;
+    std::vector<std::vector<task_id_t> > device_tasks; // tasks of each device in order, by Device::index
+    std::vector<uint32_t> prev_offsets;               // reverse of the edges of the graph
+    std::vector<task_id_t> prev_tasks;
+    std::vector<simtime_t> end_time_tree; // max of the end times, a binary tree with the tasks as leaves
+    std::vector<task_id_t> edited_tasks;
+    // state of the replay, valid where the stamp equals the epoch of the replay
+    uint32_t epoch;
+    std::vector<uint32_t> popped_epochs;
+    std::vector<uint32_t> dirty_epochs;
+    std::vector<int> counters;
+    std::vector<simtime_t> replay_ready_times;
+    std::vector<simtime_t> replay_start_times;
+    std::vector<simtime_t> replay_end_times;
+    std::vector<SubDevice *> replay_sub_devices;
+    std::vector<task_id_t> replay_order;
+    std::vector<Device const *> touched_devices;
+    std::vector<uint32_t> device_epochs;
+    std::vector<uint32_t> device_starts; // number of tasks the device ran before the replay
+    std::vector<uint32_t> device_counts; // number of tasks the device ran, by Device::index
+    std::vector<uint32_t> device_recorded_counts; // number of its recorded tasks the cursor passed
+    std::vector<char> device_synced;     // whether the device is in its recorded state
+    size_t num_unsynced_devices;
+    std::vector<simtime_t> sub_device_times; // by SubDevice::index
+    // whether all the devices with several sub-devices use round robin, which the replay follows
+    bool round_robin;
+};
+
+/**
+ * The repeated training iterations of a task graph, see iteration_folding.cc. The label of a task
+ * is its op kind and its device. The loop is made of the labels that occur a multiple of
+ * num_iterations times, and the occurrences of a label are split evenly over the iterations in
+ * the order of the task ids. The other tasks form the prologue and the epilogue. detect() only
+ * accepts the split when every iteration has the edges of the first one, the costs may differ.
+ */
+class IterationFolding
+{
+public:
+    static const int NOT_IN_LOOP = -1;
+    // returns false when the graph has no repeated iterations
+    bool detect(TaskGraph const &graph);
+    // The prologue, the first num_iterations iterations and the epilogue. The epilogue depends on
+    // the last of these iterations instead of the last iteration of the graph. The tasks keep
+    // their handles, so Task::id is the id in the full graph.
+    void truncate(TaskGraph const &graph, int num_iterations, TaskGraph &ret) const;
+    int num_iterations;
+    size_t iteration_size;         // number of tasks of an iteration
+    std::vector<int> iterations;   // iteration of each task, NOT_IN_LOOP for the prologue and epilogue
+    std::vector<uint32_t> positions; // position of each task of the loop in its iteration
+    std::vector<task_id_t> loop_tasks; // task at [iteration * iteration_size + position]
+    // edges from the last iteration to the epilogue, moved to the last simulated iteration
+    std::vector<std::pair<task_id_t, task_id_t> > last_edges;
+};
+
+/**
+ * The fluid model of the communication, see flow_model.cc. A communication task is a flow of its
+ * message over the links of its path, and the flows active on a link share its bandwidth with
+ * max-min fairness. When a flow starts or finishes, progressive filling recomputes the rates of
+ * the flows connected to it through shared links; the other flows keep their rates.
+ */
+class FlowModel
+{
+public:
+    void init(MachineModel *machine);
+    // start the flow of a task over its links, the devices of the machine model of init()
+    void start(task_id_t task, std::vector<CommDevice *> const &links, double bytes, simtime_t now);
+    // when the next flow transfers its last byte, SIMTIME_MAX when no flow is active
+    simtime_t next_finish_time();
+    // whether a flow finishes before a time. The flows that start or finish at the same time are
+    // reallocated together, so this does not reallocate them when the time is not after theirs.
+    bool finishes_before(simtime_t time);
+    // finish the next flow at next_finish_time() and return its task
+    task_id_t finish();
+    size_t num_active() const
+    {
+        return num_flows;
+    }
+    size_t peak_flows; // most flows active at the same time since init()
+
+private:
+    struct Flow
+    {
+        task_id_t task;
+        double remaining; // bytes
+        double rate;      // bytes per ms
+        simtime_t last_update;
+        uint32_t version; // of the rate, finish events of older versions are dropped
+        uint32_t epoch;
+        bool frozen;
+        std::vector<std::pair<int, uint32_t> > links; // index of each link and position of the flow in it
+    };
+    struct Link
+    {
+        double bandwidth; // bytes per ms
+        std::vector<uint32_t> flows;
+        // state of the progressive filling
+        uint32_t epoch;
+        uint32_t version;
+        double remaining;
+        uint32_t num_unfrozen;
+    };
+    struct FinishEvent
+    {
+        simtime_t time;
+        task_id_t task;
+        uint32_t flow;
+        uint32_t version;
+        bool operator>(FinishEvent const &other) const
+        {
+            return time > other.time or (time == other.time and task > other.task);
+        }
+    };
+    void reallocate();
+    std::vector<Flow> flows;
+    std::vector<uint32_t> free_flows;
+    size_t num_flows;
+    std::vector<Link> links; // by Device::index, only the communication devices are used
+    // min-heap with std::greater, compacted when the stale events outnumber the flows
+    std::vector<FinishEvent> finish_events;
+    uint32_t epoch;
+    // links of the flows started or finished at pending_time and not reallocated yet
+    std::vector<std::pair<int, uint32_t> > pending_links;
+    simtime_t pending_time;
+    // buffers of reallocate()
+    std::vector<int> component_links;
+    std::vector<uint32_t> component_flows;
+    std::priority_queue<std::tuple<double, int, uint32_t>, std::vector<std::tuple<double, int, uint32_t> >,
+                        std::greater<std::tuple<double, int, uint32_t> > >
+        shares;
+};
+
+// A transfer of a step of a collective, see collectives.cc. The ranks are indices in the tasks
+// of the collective.
+struct CollectiveTransfer
+{
+    int from;
+    int to;
+    size_t size;
+};
+
+/**
+ * The state of a macro transfer while it runs, see macro_transfers.cc. The segments are indexed
+ * by device, the devices of the path in order, and then by segment.
+ */
+struct MacroTransfer
+{
+    task_id_t task;
+    bool stepping; // whether its segments run one by one
+    simtime_t queued_time; // of its entry in the ready queue
+    simtime_t ready_time;
+    simtime_t start_time; // of its first segment
+    simtime_t run_time;   // of the segments that ran
+    int num_segments;
+    std::vector<SubDevice *> sub_devices;    // of its path on the simulated machine model
+    std::vector<char> holds_next;            // whether a segment on the device holds the next one on the previous device
+    std::vector<simtime_t> costs;            // of a segment on each device, then of the last segment
+    std::vector<simtime_t> device_ready_times; // when the devices were available before it
+    std::vector<int> num_run;                // segments that ran on each device
+    std::vector<simtime_t> ready_times;      // of the segments
+    std::vector<simtime_t> end_times;
+};
+
+/**
+ * A monotonic arena. Memory is handed out from large blocks by bumping a pointer and is never
+ * freed one object at a time: reset() rewinds to the first block and keeps all the blocks for
+ * reuse, and the destructor frees the blocks.
+ */
+class Arena
+{
+public:
+    Arena(size_t block_size = 1 << 20);
+    ~Arena();
+    void *allocate(size_t size, size_t align);
+    void reset();
+    size_t bytes_reserved() const;
+
+private:
+    Arena(Arena const &) = delete;
+    Arena &operator=(Arena const &) = delete;
+    std::vector<std::pair<char *, size_t> > blocks; // start and size of each block
+    size_t block_size;
+    size_t cur_block;
+    char *cur;
+    char *end;
+};
+
+/**
+ * A typed pool of objects living in an arena. Objects are allocated in slabs of SLAB_SIZE objects
+ * and are destroyed together by clear(), which is O(1) for trivially destructible types.
+ * The memory of the slabs goes back to the arena when the arena is reset.
+ */
+template <typename T>
+class ObjectPool
+{
+public:
+    static const size_t SLAB_SIZE = 1024;
+    explicit ObjectPool(Arena *arena) : arena(arena), num_objects(0) {}
+    ~ObjectPool() { clear(); }
+    template <typename... Args>
+    T *create(Args &&... args)
+    {
+        if (num_objects == slabs.size() * SLAB_SIZE)
+        {
+            slabs.push_back((T *)arena->allocate(SLAB_SIZE * sizeof(T), alignof(T)));
+        }
+        T *obj = slabs[num_objects / SLAB_SIZE] + num_objects % SLAB_SIZE;
+        new (obj) T(std::forward<Args>(args)...);
+        num_objects++;
+        return obj;
+    }
+    void clear()
+    {
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            for (size_t i = 0; i < num_objects; i++)
+            {
+                slabs[i / SLAB_SIZE][i % SLAB_SIZE].~T();
+            }
+        }
+        slabs.clear();
+        num_objects = 0;
+    }
+    size_t size() const { return num_objects; }
+
+private:
+    ObjectPool(ObjectPool const &) = delete;
+    ObjectPool &operator=(ObjectPool const &) = delete;
+    Arena *arena;
+    std::vector<T *> slabs;
+    size_t num_objects;
+};
+
+// Receives the schedule of every simulated task, in the order the tasks are simulated
+class TraceSink
+{
+public:
+    virtual ~TraceSink() = default;
+    // called at the start of each simulation, before the first record
+    virtual void begin(TaskGraph const &graph) {}
+    virtual void record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                        simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time) = 0;
+    // called at the end of each simulation
+    virtual void flush() {}
+};
+
+// Drops all the records, only the summary of a simulation is printed
+class NullTraceSink : public TraceSink
+{
+public:
+    void record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time) {}
+};
+
+// Prints one line per task to a stream, buffering the lines instead of flushing each of them
+class TextTraceSink : public TraceSink
+{
+public:
+    TextTraceSink(std::ostream &out, size_t buffer_size = 1 << 20);
+    ~TextTraceSink();
+    void record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time);
+    void flush();
+
+private:
+    std::ostream &out;
+    size_t buffer_size;
+    std::ostringstream buffer;
+};
+
+/**
+ * Writes fixed-size binary records (task id, device index, ready, start and end time) to a file.
+ * Layout: the header "SIMTRACE" + uint32 version, the records, then a table of the device names
+ * (uint32 count, then uint32 length + characters for each device index, empty for the devices
+ * without tasks) and finally the uint64 file offset of this table.
+ */
+class BinaryTraceSink : public TraceSink
+{
+public:
+    struct Record
+    {
+        uint32_t task_id;
+        uint32_t device_id;
+        float ready_time;
+        float start_time;
+        float end_time;
+    };
+    static const uint32_t VERSION = 1;
+    BinaryTraceSink(std::string file, size_t buffer_size = 1 << 16);
+    ~BinaryTraceSink();
+    void record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time);
+    void flush();
+
+private:
+    std::ofstream out;
+    size_t buffer_size;
+    std::vector<Record> buffer;
+    std::vector<std::string> device_names; // indexed by Device::index
+};
+
+/**
+ * Critical-path and slack analysis, written to a stream at the end of each simulation. A task is
+ * delayed either by a dependency (it starts when its last predecessor ends) or by contention (it
+ * waits for the previous task of its sub-device). Both kinds of edges make the recorded schedule
+ * a DAG, and a single backward pass over it in reverse simulation order gives the latest end of
+ * each task that does not delay sim_time, so its slack. The critical path is followed back from
+ * the last task through the edges that delayed each task. The records are forwarded to another
+ * sink if one is given, so a trace can be written as well.
+ */
+class CriticalPathSink : public TraceSink
+{
+public:
+    enum Delay
+    {
+        NOT_DELAYED, // a start task on a free sub-device
+        DEPENDENCY_DELAY,
+        DEVICE_DELAY,
+    };
+    static const task_id_t NO_TASK = UINT32_MAX;
+    CriticalPathSink(std::ostream &out, TraceSink *next = nullptr);
+    void begin(TaskGraph const &graph);
+    void record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time);
+    void flush();
+    // results of the last simulation, indexed by task id
+    std::vector<Delay> delays;
+    std::vector<simtime_t> slacks;
+    std::vector<task_id_t> critical_path; // from the first task to the last one
+
+private:
+    void analyze();
+    void report();
+    std::ostream &out;
+    TraceSink *next;
+    TaskGraph const *graph;
+    std::vector<task_id_t> order; // in simulation order, which is topological for both kinds of edges
+    std::vector<simtime_t> ready_times;
+    std::vector<simtime_t> start_times;
+    std::vector<simtime_t> end_times;
+    std::vector<SubDevice const *> sub_devices;
+    std::vector<task_id_t> device_prevs; // previous task of the same sub-device
+    std::vector<task_id_t> dependency_prevs; // a predecessor ending at the ready time of the task
+    std::vector<task_id_t> last_tasks; // indexed by SubDevice::index
+};
+
+/**
+ * Memory usage of the simulated schedule, written to a stream at the end of each simulation. The
+ * data of the graph are the messages of new_comm_task(): the output of a task lives in the memory
+ * of the task from its start to the end of the last task it is sent to, and a message that is
+ * copied to another memory takes a buffer of its size in the memory of its target from the end of
+ * the source, when the copy can start, to the end of the target. The allocations and frees are
+ * replayed in time order, frees first at the same time, to give the peak usage of every memory,
+ * its usage over time at a fixed number of intervals, and the first allocation that exceeds the
+ * capacity of its memory. The records are forwarded to another sink if one is given.
+ */
+class MemorySink : public TraceSink
+{
+public:
+    static const task_id_t NO_TASK = UINT32_MAX;
+    MemorySink(std::ostream &out, TraceSink *next = nullptr, int num_intervals = 20);
+    void begin(TaskGraph const &graph);
+    void record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time);
+    void flush();
+    // results of the last simulation, indexed by MemDevice::mem_index
+    std::vector<MemDevice const *> mems;
+    std::vector<uint64_t> peak_usages;
+    std::vector<simtime_t> peak_times;
+    // the first allocation over the capacity of its memory, NO_TASK if there is none
+    task_id_t oom_task;
+    MemDevice const *oom_mem;
+    simtime_t oom_time;
+    uint64_t oom_usage;
+
+private:
+    struct Event
+    {
+        simtime_t time;
+        bool alloc; // frees sort first
+        int64_t bytes;
+        task_id_t task;
+        MemDevice const *mem;
+        bool operator<(Event const &other) const
+        {
+            return time < other.time or (time == other.time and alloc < other.alloc);
+        }
+    };
+    void analyze();
+    void report();
+    std::ostream &out;
+    TraceSink *next;
+    TaskGraph const *graph;
+    int num_intervals;
+    bool recorded;
+    std::vector<simtime_t> start_times; // -1 if the task did not run
+    std::vector<simtime_t> end_times;
+    simtime_t sim_time;
+    std::vector<Event> events;
+    std::vector<std::vector<uint64_t> > interval_peaks; // mem_index, interval
+};
+
+/**
+ * Self-profiling of a run of the simulator: the wall time of its phases and counters of the hot
+ * paths, written as one JSON object so that the throughput can be tracked from run to run. The
+ * phases and counters are named by the code that reports them and are written in the order they
+ * were first reported. Not thread-safe, the simulators of a sweep run without it.
+ */
+class Profile
+{
+public:
+    Profile();
+    void add_time(std::string const &phase, double seconds);
+    void add_count(std::string const &counter, uint64_t value);
+    void set_max(std::string const &counter, uint64_t value);
+    void add_queue_stats(ReadyQueue::Stats const &stats);
+    void write_json(std::ostream &out) const;
+
+private:
+    std::chrono::steady_clock::time_point start;
+    std::vector<std::pair<std::string, double> > phases;
+    std::vector<std::pair<std::string, uint64_t> > counters;
+    uint64_t &get_counter(std::string const &counter);
+};
+
+// Adds the wall time from its construction to stop() to a phase, or to its destruction if stop()
+// is not called. Does nothing without a profile.
+class ProfilePhase
+{
+public:
+    ProfilePhase(Profile *profile, char const *phase);
+    ~ProfilePhase();
+    void stop();
+
+private:
+    Profile *profile;
+    char const *phase;
+    std::chrono::steady_clock::time_point start;
+};
+
 class Simulator
 {
+public:
+    enum Engine
+    {
+        SEQUENTIAL_ENGINE,
+        // Parallel engines, see simulate_conservative() and simulate_optimistic() in parallel_simulator.cc
+        CONSERVATIVE_ENGINE,
+        OPTIMISTIC_ENGINE,
+    };
+    enum CollectiveAlgorithm
+    {
+        AUTO_ALGORITHM, // the allreduce with the shortest estimate_allreduce()
+        RING_ALLREDUCE,
+        TREE_ALLREDUCE,
+        HALVING_DOUBLING_ALLREDUCE, // a power of two ranks only
+    };
+
 private:
-    std::priority_queue<Task *, std::vector<Task *>, TaskCompare> ready_queue;
+    Arena arena; // must be declared before the pools, which are destroyed first
+    ObjectPool<CompTask> comp_tasks;
+    ObjectPool<CommTask> comm_tasks;
+    std::unordered_set<std::string> interned;
+    ReadyQueue::QueueType queue_type;
+    ReadyQueue *ready_queue;
+    NullTraceSink null_trace_sink;
+    TraceSink *trace_sink;
+    Profile *profile;
+    Engine engine;
+    int num_threads;
+    bool measure_main_loop;
+    bool print_summary;
+    double fold_tolerance;
+    bool flow_model;
+    FlowModel flows;
+    bool macro_transfers;
+    // state of the macro transfers in the last simulation, see macro_transfers.cc
+    std::vector<MacroTransfer> transfers;
+    std::vector<uint32_t> free_transfers;
+    std::vector<uint32_t> transfer_slots; // slot of each task in transfers while it runs
+    // the macro transfer running on each device ahead of the other tasks, and the ready time of
+    // its last segment there, by SubDevice::index
+    std::vector<task_id_t> reserved_transfers;
+    std::vector<simtime_t> reserved_times;
+    std::vector<int> num_stepping_transfers; // with segments left on each device, by SubDevice::index
+    std::mt19937_64 rng;
+    simtime_t main_loop_start;
+    simtime_t main_loop_stop;
+    void simulate_sequential(TaskGraph const &graph);
+    // simulate the tasks in the ready queue and all the tasks they enable
+    void process_ready_queue(TaskGraph const &graph);
+    bool simulate_conservative(TaskGraph const &graph);
+    bool simulate_optimistic(TaskGraph const &graph);
+    void simulate_folded(TaskGraph const &graph);
+    void simulate_flows(TaskGraph const &graph);
+    void simulate_pipelined(TaskGraph const &graph);
+    // handle an entry of a macro transfer in the ready queue, returns when the transfer ends if
+    // it is finished, SIMTIME_MAX otherwise
+    simtime_t run_transfer(TaskGraph const &graph, ReadyTask const &entry);
+    void start_transfer(TaskGraph const &graph, ReadyTask const &entry);
+    // switch a transfer to stepping, keeping the segments that run before a ready queue entry
+    void split_transfer(uint32_t slot, ReadyTask const &entry);
+    // the segment of a stepping transfer to run next and its ready time, false when none is ready
+    bool next_segment(MacroTransfer const &transfer, size_t &hop, simtime_t &ready_time) const;
+    // run the next segment of a stepping transfer, returns whether it was the last one
+    bool step_transfer(uint32_t slot, ReadyTask const &entry);
+    // split the macro transfer running on a device ahead of a ready queue entry for it
+    void claim_device(SubDevice const *sub_device, ReadyTask const &entry);
+    // build the tasks of the steps of a collective, see collectives.cc
+    void new_collective(std::string const &name, std::vector<Task *> const &src_tasks,
+                        std::vector<Task *> const &tar_tasks, std::vector<std::vector<CollectiveTransfer> > const &steps);
+    void print_totals() const;
+    // add a simulated task to the totals and the trace, in the order of the sequential engine
+    void account(TaskGraph const &graph, task_id_t task, SubDevice *sub_device, simtime_t task_ready_time,
+                 simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time);
+    bool incremental;
 
 public:
     MachineModel *machine;
-    Simulator(MachineModel *machine);
+    TaskGraph graph;
+    // results of the last simulation
+    simtime_t sim_time;
+    simtime_t total_comp_time;
+    simtime_t total_comm_time;
+    int total_simulated_comp_tasks;
+    // results of the last folded simulation, num_iterations is 0 when it was not folded
+    int num_iterations;
+    int num_simulated_iterations;
+    simtime_t iteration_time;
+    simtime_t fold_error_bound;
+    RunState run; // state of the last simulation
+    Schedule schedule; // schedule of the last simulation, only recorded in incremental mode
+    Simulator(MachineModel *machine, ReadyQueue::QueueType queue_type = ReadyQueue::HEAP_QUEUE);
+    ~Simulator();
+    // drop all the tasks and reuse their memory for building a new task graph
+    void reset();
     Task *new_comp_task(std::string name, CompDevice *comp_device, float run_time, MemDevice *mem_device);
+    Task *new_comp_task(TaskName name, CompDevice *comp_device, float run_time, MemDevice *mem_device);
+    // the copy of a string kept by the simulator for the names and the kinds of its tasks, the
+    // same for equal strings until reset()
+    std::string const *intern(std::string const &text);
     void new_comm_task(Task *src_task, Task *tar_task, size_t message_size);
+    // Collectives, see collectives.cc. Rank i of a collective is the memory and the device of
+    // src_tasks[i], it takes part when src_tasks[i] ends and tar_tasks[i] waits for its result.
+    // The allreduce reduces message_size bytes over the ranks and returns the algorithm it used.
+    CollectiveAlgorithm new_allreduce(std::vector<Task *> const &src_tasks, std::vector<Task *> const &tar_tasks,
+                                      size_t message_size, CollectiveAlgorithm algorithm = AUTO_ALGORITHM);
+    // every rank sends message_size bytes to every other one
+    void new_all_to_all(std::vector<Task *> const &src_tasks, std::vector<Task *> const &tar_tasks, size_t message_size);
+    // the time in ms of an allreduce alone on the machine, from the load of its steps on the
+    // links, infinity when the algorithm does not apply to the ranks
+    float estimate_allreduce(std::vector<Task *> const &src_tasks, size_t message_size, CollectiveAlgorithm algorithm);
     void enter_ready_queue(Task *task);
     void add_dependency(std::vector<Task *> prev_tasks, Task *cur_task);
     void add_dependency(Task *prev_task, Task *cur_task);
+    // the sink is not owned by the simulator, nullptr restores the summary-only default
+    void set_trace_sink(TraceSink *sink);
+    // the profile is not owned by the simulator, nullptr turns profiling off
+    void set_profile(Profile *profile);
+    Profile *get_profile() const;
+    // the parallel engines fall back to the sequential one when the task graph cannot be partitioned
+    void set_engine(Engine engine, int num_threads = 1);
+    // print the totals after every simulation, on by default
+    void set_print_summary(bool print_summary);
+    // The random choices of a simulation, e.g. the background worker of a realm task, are drawn
+    // from the generator of its simulator, which set_seed() restarts, so equal seeds give equal
+    // results. The seed is 0 by default.
+    void set_seed(uint64_t seed);
+    std::mt19937_64 &get_rng();
+    // The flow model, see flow_model.cc, off by default. It must be set before building the
+    // graph: new_comm_task() then creates one task per message over its whole path instead of
+    // segments on every link. The engine is always the sequential one, and it cannot be combined
+    // with incremental mode.
+    void set_flow_model(bool flow_model);
+    // Macro transfers, see macro_transfers.cc, off by default. Like the flow model, it must be set
+    // before building the graph, which then has one task per message instead of its segments. The
+    // results are the ones of the segmented model. The engine is always the sequential one, the
+    // flow model turns it off and it cannot be combined with incremental mode.
+    void set_macro_transfers(bool macro_transfers);
+    // Iteration folding, see iteration_folding.cc. With a tolerance above 0, simulate() looks for
+    // repeated iterations, simulates the first ones until the time of an iteration varies by less
+    // than the tolerance, a fraction of it, and extrapolates the others. The totals still cover
+    // every task. The trace sink sees no folded simulation, and incremental mode turns it off.
+    void set_iteration_folding(double tolerance);
+    // simulate the graph built by this simulator
     void simulate();
+    // simulate a finished graph, which may be shared with other simulators, see RunState::init()
+    void simulate(TaskGraph const &graph);
+    // Incremental re-simulation. With it on, simulate() records the schedule of the tasks. The
+    // costs and the devices of tasks can then be edited, and resimulate() updates the results by
+    // replaying only the part of the schedule the edits change. The edits live in the run state
+    // and are dropped by the next simulate(); the trace sink only sees full simulations.
+    void set_incremental(bool incremental);
+    void set_run_time(Task *task, float run_time);
+    // only for comp tasks, the communication tasks keep their paths
+    void set_device(Task *task, CompDevice *device);
+    // returns the new sim_time
+    simtime_t resimulate();
+    void print_device_stats() const;
 };
 
 inline bool starts_with(std::string s, std::string sub)
@@ -0,0 +1,495 @@
+#include "simulator.h"
+#include <algorithm>
+#include <map>
+
+using std::string;
+
+// class TextTraceSink
+TextTraceSink::TextTraceSink(std::ostream &out, size_t buffer_size)
+    : out(out), buffer_size(buffer_size)
+{
+}
+
+TextTraceSink::~TextTraceSink()
+{
+    flush();
+}
+
+void TextTraceSink::record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                           simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time)
+{
+    buffer << task->name.to_string() << " --- " << task->device->name << " --- "
+           << "task_ready(" << to_ms(task_ready_time) << ") device_ready(" << to_ms(device_ready_time) << ") start(" << to_ms(start_time) << ") run(" << to_ms(run_time) << ") end(" << to_ms(end_time) << ")\n";
+    if ((size_t)buffer.tellp() >= buffer_size)
+    {
+        out << buffer.str();
+        buffer.str("");
+    }
+}
+
+void TextTraceSink::flush()
+{
+    out << buffer.str();
+    out.flush();
+    buffer.str("");
+}
+
+// class BinaryTraceSink
+BinaryTraceSink::BinaryTraceSink(string file, size_t buffer_size)
+    : out(file, std::ios::binary), buffer_size(buffer_size)
+{
+    if (!out.is_open())
+    {
+        printf("BinaryTraceSink: cannot open %s\n", file.c_str());
+        assert(false);
+    }
+    uint32_t version = VERSION;
+    out.write("SIMTRACE", 8);
+    out.write((char const *)&version, sizeof(version));
+    buffer.reserve(buffer_size);
+}
+
+BinaryTraceSink::~BinaryTraceSink()
+{
+    flush();
+    uint64_t table_offset = out.tellp();
+    uint32_t num_devices = device_names.size();
+    out.write((char const *)&num_devices, sizeof(num_devices));
+    for (size_t i = 0; i < device_names.size(); i++)
+    {
+        uint32_t length = device_names[i].size();
+        out.write((char const *)&length, sizeof(length));
+        out.write(device_names[i].data(), length);
+    }
+    out.write((char const *)&table_offset, sizeof(table_offset));
+}
+
+void BinaryTraceSink::record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                             simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time)
+{
+    Device const *device = task->device;
+    if ((size_t)device->index >= device_names.size())
+    {
+        device_names.resize(device->index + 1);
+    }
+    if (device_names[device->index].empty())
+    {
+        device_names[device->index] = device->name;
+    }
+    buffer.push_back({task->id, (uint32_t)device->index, (float)to_ms(task_ready_time), (float)to_ms(start_time),
+                      (float)to_ms(end_time)});
+    if (buffer.size() >= buffer_size)
+    {
+        flush();
+    }
+}
+
+void BinaryTraceSink::flush()
+{
+    out.write((char const *)buffer.data(), buffer.size() * sizeof(Record));
+    out.flush();
+    buffer.clear();
+}
+
+// class CriticalPathSink
+const task_id_t CriticalPathSink::NO_TASK;
+
+CriticalPathSink::CriticalPathSink(std::ostream &out, TraceSink *next)
+    : out(out), next(next), graph(nullptr)
+{
+}
+
+void CriticalPathSink::begin(TaskGraph const &graph)
+{
+    this->graph = &graph;
+    size_t num_tasks = graph.num_tasks();
+    order.clear();
+    order.reserve(num_tasks);
+    ready_times.assign(num_tasks, 0);
+    start_times.assign(num_tasks, 0);
+    end_times.assign(num_tasks, 0);
+    sub_devices.assign(num_tasks, nullptr);
+    device_prevs.assign(num_tasks, NO_TASK);
+    dependency_prevs.assign(num_tasks, NO_TASK);
+    last_tasks.clear();
+    if (next != nullptr)
+    {
+        next->begin(graph);
+    }
+}
+
+void CriticalPathSink::record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                              simtime_t device_ready_time, simtime_t start_time, simtime_t run_time,
+                              simtime_t end_time)
+{
+    task_id_t id = task->id;
+    order.push_back(id);
+    ready_times[id] = task_ready_time;
+    start_times[id] = start_time;
+    end_times[id] = end_time;
+    sub_devices[id] = sub_device;
+    if ((size_t)sub_device->index >= last_tasks.size())
+    {
+        last_tasks.resize(sub_device->index + 1, NO_TASK);
+    }
+    device_prevs[id] = last_tasks[sub_device->index];
+    last_tasks[sub_device->index] = id;
+    if (next != nullptr)
+    {
+        next->record(task, sub_device, task_ready_time, device_ready_time, start_time, run_time, end_time);
+    }
+}
+
+void CriticalPathSink::flush()
+{
+    if (graph != nullptr and !order.empty())
+    {
+        analyze();
+        report();
+        order.clear();
+    }
+    if (next != nullptr)
+    {
+        next->flush();
+    }
+}
+
+void CriticalPathSink::analyze()
+{
+    simtime_t sim_time = 0;
+    task_id_t last_task = NO_TASK;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        if (last_task == NO_TASK or end_times[order[i]] > sim_time)
+        {
+            sim_time = end_times[order[i]];
+            last_task = order[i];
+        }
+    }
+    // The latest end of a task is bounded by the latest start of its successors in the graph and
+    // of the next task on its sub-device. Both come later in the simulation order, so the reverse
+    // order visits every task after all its successors: the graph successors are pulled through
+    // the forward edges and each task pushes its latest start to the previous task of its
+    // sub-device. The same pass finds the predecessor that made each task ready.
+    std::vector<simtime_t> latest_ends(graph->num_tasks(), sim_time);
+    delays.assign(graph->num_tasks(), NOT_DELAYED);
+    slacks.assign(graph->num_tasks(), 0);
+    for (size_t i = order.size(); i-- > 0;)
+    {
+        task_id_t task = order[i];
+        for (uint32_t j = graph->next_offsets[task]; j < graph->next_offsets[task + 1]; j++)
+        {
+            task_id_t next_task = graph->next_tasks[j];
+            latest_ends[task] =
+                std::min(latest_ends[task], latest_ends[next_task] - (end_times[next_task] - start_times[next_task]));
+            if (end_times[task] == ready_times[next_task])
+            {
+                dependency_prevs[next_task] = task;
+            }
+        }
+        if (device_prevs[task] != NO_TASK)
+        {
+            latest_ends[device_prevs[task]] = std::min(latest_ends[device_prevs[task]],
+                                                       latest_ends[task] - (end_times[task] - start_times[task]));
+        }
+        slacks[task] = std::max((simtime_t)0, latest_ends[task] - end_times[task]);
+        if (start_times[task] > ready_times[task])
+        {
+            delays[task] = DEVICE_DELAY;
+        }
+        else if (ready_times[task] > 0)
+        {
+            delays[task] = DEPENDENCY_DELAY;
+        }
+    }
+    critical_path.clear();
+    for (task_id_t task = last_task; task != NO_TASK;)
+    {
+        critical_path.push_back(task);
+        if (delays[task] == DEVICE_DELAY)
+        {
+            task = device_prevs[task];
+        }
+        else
+        {
+            // a task ready at time 0 may still have zero-cost predecessors
+            task = dependency_prevs[task];
+        }
+    }
+    std::reverse(critical_path.begin(), critical_path.end());
+}
+
+void CriticalPathSink::report()
+{
+    static char const *delay_names[] = {"none", "dependency", "device"};
+    struct Totals
+    {
+        int num_tasks;
+        simtime_t busy_time;
+        simtime_t critical_time;
+        simtime_t wait_time; // between the ready time and the start time
+        simtime_t min_slack;
+    };
+    auto add = [&](Totals &totals, task_id_t task, bool critical) {
+        simtime_t run_time = end_times[task] - start_times[task];
+        if (totals.num_tasks == 0 or slacks[task] < totals.min_slack)
+        {
+            totals.min_slack = slacks[task];
+        }
+        totals.num_tasks++;
+        totals.busy_time += run_time;
+        totals.critical_time += critical ? run_time : 0;
+        totals.wait_time += start_times[task] - ready_times[task];
+    };
+    auto kind_of = [&](task_id_t task) -> string {
+        Task const *handle = graph->tasks[task];
+        if (handle->kind != nullptr)
+        {
+            return *handle->kind;
+        }
+        return sub_devices[task]->main_device->type == Device::DEVICE_COMM ? "comm" : "comp";
+    };
+
+    std::vector<bool> critical(graph->num_tasks(), false);
+    int num_device_delays = 0;
+    for (size_t i = 0; i < critical_path.size(); i++)
+    {
+        critical[critical_path[i]] = true;
+        num_device_delays += delays[critical_path[i]] == DEVICE_DELAY;
+    }
+    task_id_t last_task = critical_path.back();
+    out << "critical_path tasks " << critical_path.size() << " length " << to_ms(end_times[last_task]) << "ms"
+        << " device_delays " << num_device_delays << "\n";
+    for (size_t i = 0; i < critical_path.size(); i++)
+    {
+        task_id_t task = critical_path[i];
+        out << "critical_task " << graph->tasks[task]->name.to_string() << " --- " << sub_devices[task]->main_device->name
+            << " --- kind(" << kind_of(task) << ") ready(" << to_ms(ready_times[task]) << ") start("
+            << to_ms(start_times[task]) << ") end(" << to_ms(end_times[task]) << ") delayed_by("
+            << delay_names[delays[task]] << ")\n";
+    }
+
+    // devices in the order of the machine model, op kinds by name
+    std::vector<Device const *> devices;
+    std::vector<Totals> device_totals;
+    std::map<string, Totals> kind_totals;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        task_id_t task = order[i];
+        Device const *device = sub_devices[task]->main_device;
+        if ((size_t)device->index >= devices.size())
+        {
+            devices.resize(device->index + 1, nullptr);
+            device_totals.resize(device->index + 1, Totals());
+        }
+        devices[device->index] = device;
+        add(device_totals[device->index], task, critical[task]);
+        auto it = kind_totals.insert(std::make_pair(kind_of(task), Totals())).first;
+        add(it->second, task, critical[task]);
+    }
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        if (devices[i] == nullptr)
+        {
+            continue;
+        }
+        Totals const &totals = device_totals[i];
+        out << "critical_device " << devices[i]->name << " tasks " << totals.num_tasks << " busy "
+            << to_ms(totals.busy_time) << "ms critical " << to_ms(totals.critical_time) << "ms wait "
+            << to_ms(totals.wait_time) << "ms min_slack " << to_ms(totals.min_slack) << "ms\n";
+    }
+    for (auto it = kind_totals.begin(); it != kind_totals.end(); ++it)
+    {
+        Totals const &totals = it->second;
+        out << "critical_kind " << it->first << " --- tasks " << totals.num_tasks << " busy "
+            << to_ms(totals.busy_time) << "ms critical " << to_ms(totals.critical_time) << "ms wait "
+            << to_ms(totals.wait_time) << "ms min_slack " << to_ms(totals.min_slack) << "ms\n";
+    }
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        task_id_t task = order[i];
+        out << "slack " << graph->tasks[task]->name.to_string() << " " << to_ms(slacks[task]) << "ms delayed_by("
+            << delay_names[delays[task]] << ")\n";
+    }
+    out.flush();
+}
+
+// class MemorySink
+MemorySink::MemorySink(std::ostream &out, TraceSink *next, int num_intervals)
+    : oom_task(NO_TASK), oom_mem(nullptr), oom_time(0), oom_usage(0), out(out), next(next), graph(nullptr),
+      num_intervals(num_intervals), recorded(false), sim_time(0)
+{
+    assert(num_intervals > 0);
+}
+
+void MemorySink::begin(TaskGraph const &graph)
+{
+    this->graph = &graph;
+    recorded = false;
+    start_times.assign(graph.num_tasks(), -1);
+    end_times.assign(graph.num_tasks(), 0);
+    sim_time = 0;
+    if (next != nullptr)
+    {
+        next->begin(graph);
+    }
+}
+
+void MemorySink::record(Task const *task, SubDevice const *sub_device, simtime_t task_ready_time,
+                        simtime_t device_ready_time, simtime_t start_time, simtime_t run_time, simtime_t end_time)
+{
+    recorded = true;
+    start_times[task->id] = start_time;
+    end_times[task->id] = end_time;
+    sim_time = std::max(sim_time, end_time);
+    if (next != nullptr)
+    {
+        next->record(task, sub_device, task_ready_time, device_ready_time, start_time, run_time, end_time);
+    }
+}
+
+void MemorySink::flush()
+{
+    if (graph != nullptr and recorded)
+    {
+        analyze();
+        report();
+        recorded = false;
+    }
+    if (next != nullptr)
+    {
+        next->flush();
+    }
+}
+
+void MemorySink::analyze()
+{
+    auto mem_of = [&](task_id_t task) { return ((CompTask const *)graph->tasks[task])->mem; };
+    // the size of the output of each task and the end of the last task it is sent to
+    std::vector<uint64_t> output_sizes(graph->num_tasks(), 0);
+    std::vector<simtime_t> free_times(end_times);
+    events.clear();
+    for (size_t i = 0; i < graph->messages.size(); i++)
+    {
+        TaskGraph::Message const &message = graph->messages[i];
+        if (start_times[message.src] < 0 or start_times[message.tar] < 0)
+        {
+            continue;
+        }
+        output_sizes[message.src] = std::max(output_sizes[message.src], message.size);
+        free_times[message.src] = std::max(free_times[message.src], end_times[message.tar]);
+        if (message.copy and mem_of(message.tar) != nullptr)
+        {
+            events.push_back({end_times[message.src], true, (int64_t)message.size, message.tar, mem_of(message.tar)});
+            events.push_back({end_times[message.tar], false, -(int64_t)message.size, message.tar, mem_of(message.tar)});
+        }
+    }
+    for (task_id_t task = 0; task < graph->num_tasks(); task++)
+    {
+        if (output_sizes[task] > 0 and mem_of(task) != nullptr)
+        {
+            events.push_back({start_times[task], true, (int64_t)output_sizes[task], task, mem_of(task)});
+            events.push_back({free_times[task], false, -(int64_t)output_sizes[task], task, mem_of(task)});
+        }
+    }
+    std::stable_sort(events.begin(), events.end());
+
+    mems.clear();
+    peak_usages.clear();
+    peak_times.clear();
+    interval_peaks.clear();
+    oom_task = NO_TASK;
+    std::vector<uint64_t> usages;
+    std::vector<int> last_intervals; // the last interval of each memory with an event
+    // the usage at the end of an interval carries over to the next ones until the next event
+    auto carry_over = [&](size_t mem, int interval) {
+        for (int i = last_intervals[mem] + 1; i <= interval; i++)
+        {
+            interval_peaks[mem][i] = usages[mem];
+        }
+        last_intervals[mem] = std::max(last_intervals[mem], interval);
+    };
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        Event const &event = events[i];
+        size_t mem = event.mem->mem_index;
+        if (mem >= mems.size())
+        {
+            mems.resize(mem + 1, nullptr);
+            usages.resize(mem + 1, 0);
+            last_intervals.resize(mem + 1, -1);
+            peak_usages.resize(mem + 1, 0);
+            peak_times.resize(mem + 1, 0);
+            interval_peaks.resize(mem + 1, std::vector<uint64_t>(num_intervals, 0));
+        }
+        mems[mem] = event.mem;
+        int interval = 0;
+        if (sim_time > 0)
+        {
+            interval = std::min((int64_t)num_intervals - 1, (int64_t)(event.time * num_intervals / sim_time));
+        }
+        carry_over(mem, interval);
+        usages[mem] += event.bytes;
+        interval_peaks[mem][interval] = std::max(interval_peaks[mem][interval], usages[mem]);
+        if (usages[mem] > peak_usages[mem])
+        {
+            peak_usages[mem] = usages[mem];
+            peak_times[mem] = event.time;
+        }
+        if (oom_task == NO_TASK and event.mem->capacity > 0 and usages[mem] > event.mem->capacity)
+        {
+            oom_task = event.task;
+            oom_mem = event.mem;
+            oom_time = event.time;
+            oom_usage = usages[mem];
+        }
+    }
+    for (size_t mem = 0; mem < mems.size(); mem++)
+    {
+        if (mems[mem] != nullptr)
+        {
+            carry_over(mem, num_intervals - 1);
+        }
+    }
+}
+
+void MemorySink::report()
+{
+    auto mb = [](uint64_t bytes) { return bytes / (double)(1 << 20); };
+    for (size_t mem = 0; mem < mems.size(); mem++)
+    {
+        if (mems[mem] == nullptr)
+        {
+            continue;
+        }
+        out << "memory " << mems[mem]->name << " capacity ";
+        if (mems[mem]->capacity > 0)
+        {
+            out << mb(mems[mem]->capacity) << "MB";
+        }
+        else
+        {
+            out << "unlimited";
+        }
+        out << " peak " << mb(peak_usages[mem]) << "MB at " << to_ms(peak_times[mem]) << "ms\n";
+    }
+    for (size_t mem = 0; mem < mems.size(); mem++)
+    {
+        if (mems[mem] == nullptr)
+        {
+            continue;
+        }
+        out << "memory_usage " << mems[mem]->name << " interval " << to_ms(sim_time) / num_intervals << "ms MB";
+        for (int i = 0; i < num_intervals; i++)
+        {
+            out << " " << mb(interval_peaks[mem][i]);
+        }
+        out << "\n";
+    }
+    if (oom_task != NO_TASK)
+    {
+        out << "oom " << oom_mem->name << " task " << graph->tasks[oom_task]->name.to_string() << " at "
+            << to_ms(oom_time) << "ms usage " << mb(oom_usage) << "MB capacity " << mb(oom_mem->capacity) << "MB\n";
+    }
+    out.flush();
+}